@@ -0,0 +1,20 @@
+# dict-heavy gc test: keeps a lot of dicts alive, so that
+# collections spend their time scanning dict storage
+
+def make(n):
+    d = {}
+    for i in xrange(n):
+        d[i] = (i, i)
+    return d
+
+l = []
+for i in xrange(2000):
+    l.append(make(100))
+
+t = 0
+n = 200
+while n:
+    n = n - 1
+    d = make(1000)
+    t = t + d[999][0]
+print t, len(l)
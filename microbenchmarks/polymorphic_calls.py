@@ -0,0 +1,18 @@
+# Calls a function with several different argument types from the same call sites, so that it
+# ends up with a version per type and the calls have to pick between them; run with -s to see
+# callsite_cache_hits and callsite_cache_misses.
+
+class C(object):
+    pass
+
+def f(x, y):
+    return y
+
+def g(args, n):
+    t = 0
+    for i in xrange(n):
+        for a in args:
+            t = t + f(a, i)
+    return t
+
+print g([1, 1.0, "a", C(), [], (1,)], 1000000)
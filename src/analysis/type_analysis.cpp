@@ -24,6 +24,8 @@
 #include "analysis/scoping_analysis.h"
 #include "analysis/type_analysis.h"
 
+#include "codegen/type_recording.h"
+
 #include "runtime/types.h"
 
 //#undef VERBOSITY
@@ -55,6 +57,14 @@ static ConcreteCompilerType* unboxedType(ConcreteCompilerType *t) {
     return t;
 }
 
+// What the lower tiers saw this node evaluate to (see type_recording.h):
+static BoxedClass* profiledSpeculation(AST_expr* node, CompilerType* rtn_type) {
+    if (rtn_type == UNDEF || rtn_type->getConcreteType()->llvmType() != g.llvm_value_type_ptr)
+        return NULL;
+
+    return predictClassFor(node);
+}
+
 static BoxedClass* simpleCallSpeculation(AST_Call* node, CompilerType* rtn_type, std::vector<CompilerType*> arg_types) {
     if (rtn_type->getConcreteType()->llvmType() != g.llvm_value_type_ptr) {
         //printf("Not right shape; it's %s\n", rtn_type->debugName().c_str());
@@ -67,7 +77,12 @@ static BoxedClass* simpleCallSpeculation(AST_Call* node, CompilerType* rtn_type,
     //if (node->func->type == AST_TYPE::Attribute && static_cast<AST_Attribute*>(node->func)->attr == "dot")
         //return float_cls;
 
-    return NULL;
+    return profiledSpeculation(node, rtn_type);
+}
+
+static std::unordered_set<AST_expr*> disabled_speculations;
+void disableSpeculation(AST_expr* node) {
+    disabled_speculations.insert(node);
 }
 
 typedef std::unordered_map<std::string, CompilerType*> TypeMap;
@@ -97,7 +112,7 @@ class BasicBlockTypePropagator : public ExprVisitor, public StmtVisitor {
             assert(old_type);
             assert(speculation != TypeAnalysis::NONE);
 
-            if (speculated_cls != NULL) {
+            if (speculated_cls != NULL && !disabled_speculations.count(node)) {
                 ConcreteCompilerType* speculated_type = unboxedType(typeFromClass(speculated_cls));
                 if (VERBOSITY() >= 2) {
                     printf("in propagator, speculating that %s would actually be %s, at:\n", old_type->debugName().c_str(), speculated_type->debugName().c_str());
@@ -165,6 +180,9 @@ class BasicBlockTypePropagator : public ExprVisitor, public StmtVisitor {
                 //rtn = processSpeculation(float_cls, node, rtn);
             //}
 
+            if (speculation != TypeAnalysis::NONE)
+                rtn = processSpeculation(profiledSpeculation(node, rtn), node, rtn);
+
             if (VERBOSITY() >= 2 && rtn == UNDEF) {
                 printf("Think %s.%s is undefined, at %d:%d\n", t->debugName().c_str(), node->attr.c_str(), node->lineno, node->col_offset);
                 print_ast(node);
@@ -200,6 +218,9 @@ class BasicBlockTypePropagator : public ExprVisitor, public StmtVisitor {
                 ASSERT((rtn == left || rtn == UNDEF) && "not strictly required but probably something worth looking into", "%s %s", name.c_str(), rtn->debugName().c_str());
             }
 
+            if (speculation != TypeAnalysis::NONE)
+                rtn = processSpeculation(profiledSpeculation(node, rtn), node, rtn);
+
             return rtn;
         }
 
@@ -315,7 +336,12 @@ class BasicBlockTypePropagator : public ExprVisitor, public StmtVisitor {
             CompilerType *getitem_type = val->getattrType("__getitem__");
             std::vector<CompilerType*> args;
             args.push_back(slice);
-            return getitem_type->callType(args);
+            CompilerType *rtn = getitem_type->callType(args);
+
+            if (speculation != TypeAnalysis::NONE)
+                rtn = processSpeculation(profiledSpeculation(node, rtn), node, rtn);
+
+            return rtn;
         }
 
         virtual void* visit_tuple(AST_Tuple *node) {
@@ -39,6 +39,9 @@ class TypeAnalysis {
         virtual BoxedClass* speculatedExprClass(AST_expr*) = 0;
 };
 
+// Keeps future analyses from speculating on the value of this node, since that keeps failing:
+void disableSpeculation(AST_expr* node);
+
 //TypeAnalysis* analyze(CFG *cfg, std::unordered_map<std::string, ConcreteCompilerType*> arg_types);
 TypeAnalysis* doTypeAnalysis(CFG *cfg, const std::vector<AST_expr*> &arg_names, const std::vector<ConcreteCompilerType*> &arg_types, TypeAnalysis::SpeculationLevel speculation, ScopeInfo *scope_info);
 
@@ -52,7 +52,8 @@ void ICInvalidator::invalidateAll() {
 
 
 void ICSlotInfo::clear() {
-    ic->clear(this);
+    if (ic)
+        ic->clear(this);
 }
 
 ICSlotRewrite::ICSlotRewrite(ICInfo* ic, const char* debug_name) : ic(ic), debug_name(debug_name) {
@@ -179,6 +180,22 @@ ICInfo::ICInfo(void* start_addr, void* continue_addr, StackInfo stack_info, int
     }
 }
 
+ICInfo::~ICInfo() {
+    // ICInvalidators don't know which of their dependents belong to which IC, so they can still
+    // have pointers to the slots that got patched.  Those slots are left behind as no-ops
+    // rather than being freed.
+    bool any_patched = false;
+    for (SlotInfo &sinfo : slots) {
+        sinfo.entry.ic = NULL;
+        if (sinfo.is_patched)
+            any_patched = true;
+    }
+    if (any_patched) {
+        // Moving the vector keeps the elements where they are:
+        new std::vector<SlotInfo>(std::move(slots));
+    }
+}
+
 static std::unordered_map<void*, ICInfo*> ics_by_return_addr;
 void registerCompiledPatchpoint(uint8_t* start_addr, PatchpointSetupInfo* pp, StackInfo stack_info, std::unordered_set<int> live_outs) {
     int size = pp->totalSize();
@@ -244,6 +261,18 @@ ICInfo* getICInfo(void* rtn_addr) {
     return it->second;
 }
 
+void deregisterCompiledPatchpoints(void* start_addr, void* end_addr) {
+    for (std::unordered_map<void*, ICInfo*>::iterator it = ics_by_return_addr.begin(); it != ics_by_return_addr.end();) {
+        ICInfo* ic = it->second;
+        if (start_addr <= ic->start_addr && ic->start_addr < end_addr) {
+            delete ic;
+            it = ics_by_return_addr.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
 void ICInfo::clear(ICSlotInfo* icentry) {
     assert(icentry);
 
@@ -31,6 +31,7 @@ struct ICSlotInfo {
     public:
         ICSlotInfo(ICInfo* ic, int idx) : ic(ic), idx(idx) {}
 
+        // NULL once the IC has been freed (see ~ICInfo()):
         ICInfo *ic;
         int idx;
 
@@ -96,6 +97,7 @@ class ICInfo {
 
     public:
         ICInfo(void* start_addr, void* continue_addr, StackInfo stack_info, int num_slots, int slot_size, llvm::CallingConv::ID calling_conv, const std::unordered_set<int> &live_outs, assembler::GenericRegister return_register);
+        ~ICInfo();
         void *const start_addr, *const continue_addr;
 
         int getSlotSize() { return slot_size; }
@@ -113,6 +115,8 @@ class PatchpointSetupInfo;
 void registerCompiledPatchpoint(uint8_t* start_addr, PatchpointSetupInfo*, StackInfo stack_info, std::unordered_set<int> live_outs);
 
 ICInfo* getICInfo(void* rtn_addr);
+// Frees the ICInfos of the patchpoints in [start_addr, end_addr), for when the code there gets freed.
+void deregisterCompiledPatchpoints(void* start_addr, void* end_addr);
 
 
 }
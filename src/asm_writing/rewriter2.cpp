@@ -446,9 +446,13 @@ RewriterVarUsage2 Rewriter2::call(bool can_call_into_python, void* func_addr, st
             bool is_immediate;
             assembler::Immediate imm = var->tryGetAsImmediate(&is_immediate);
 
-            assert(is_immediate);
-            assembler->mov(imm, r);
-            addLocationToVar(var, l);
+            if (is_immediate) {
+                assembler->mov(imm, r);
+                addLocationToVar(var, l);
+            } else {
+                assembler::Register r3 = var->getInReg(l);
+                assert(r3 == r);
+            }
         }
 
         assert(var->isInLocation(Location::forArg(i)));
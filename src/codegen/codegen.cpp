@@ -34,6 +34,21 @@ void FunctionAddressRegistry::registerFunction(const std::string& name, void* ad
     functions.insert(std::make_pair(addr, FuncInfo(name, length, llvm_func)));
 }
 
+void FunctionAddressRegistry::unregisterFunctions(void* start, void* end) {
+    for (FuncMap::iterator it = functions.begin(); it != functions.end();) {
+        if (start <= it->first && it->first < end)
+            it = functions.erase(it);
+        else
+            ++it;
+    }
+    for (std::unordered_set<void*>::iterator it = lookup_neg_cache.begin(); it != lookup_neg_cache.end();) {
+        if (start <= *it && *it < end)
+            it = lookup_neg_cache.erase(it);
+        else
+            ++it;
+    }
+}
+
 void FunctionAddressRegistry::dumpPerfMap() {
     std::string out_path = "perf_map";
     removeDirectoryIfExists(out_path);
@@ -129,6 +144,18 @@ std::string FunctionAddressRegistry::getFuncNameAtAddress(void* addr, bool deman
     return tryDemangle(it->second.name.c_str());
 }
 
+std::string FunctionAddressRegistry::getFuncNameContainingAddress(void* addr, bool demangle, bool *out_success) {
+    // Functions are only looked up by their start address, so scan for one whose code covers addr;
+    // this is slow, so it's only meant for things like dumping profiles.
+    for (const auto &p : functions) {
+        if (p.first <= addr && addr < (char*)p.first + p.second.length)
+            return getFuncNameAtAddress(p.first, demangle, out_success);
+    }
+
+    // dladdr will find the enclosing symbol for non-jitted code:
+    return getFuncNameAtAddress(addr, demangle, out_success);
+}
+
 class RegistryEventListener : public llvm::JITEventListener {
     public:
         void NotifyObjectEmitted(const llvm::ObjectImage &Obj) {
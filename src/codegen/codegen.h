@@ -51,8 +51,12 @@ class FunctionAddressRegistry {
 
     public:
         std::string getFuncNameAtAddress(void* addr, bool demangle, bool *out_success=NULL);
+        // Like getFuncNameAtAddress, but addr can be anywhere inside the function (eg a return address).
+        std::string getFuncNameContainingAddress(void* addr, bool demangle, bool *out_success=NULL);
         llvm::Function* getLLVMFuncAtAddress(void* addr);
         void registerFunction(const std::string &name, void *addr, int length, llvm::Function* llvm_func);
+        // Forgets the functions that start in [start, end), for when their code gets freed.
+        void unregisterFunctions(void* start, void* end);
         void dumpPerfMap();
 };
 
@@ -24,6 +24,7 @@
 #include "codegen/compvars.h"
 #include "codegen/gcbuilder.h"
 #include "codegen/patchpoints.h"
+#include "codegen/reclaim.h"
 #include "codegen/irgen.h"
 #include "codegen/irgen/util.h"
 
@@ -957,6 +958,7 @@ class NormalObjectType : public ConcreteCompilerType {
                     llvm::FunctionType *ft = llvm::FunctionType::get(cf->sig->rtn_type->llvmType(), arg_types, false);
 
                     llvm::Value *linked_function = embedConstantPtr(cf->code, ft->getPointerTo());
+                    pinCode(cf);
 
                     std::vector<CompilerVariable*> new_args;
                     new_args.push_back(var);
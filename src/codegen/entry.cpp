@@ -20,7 +20,6 @@
 #include "llvm/Bitcode/ReaderWriter.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/MCJIT.h"
-#include "llvm/ExecutionEngine/ObjectCache.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Support/CommandLine.h"
@@ -32,6 +31,7 @@
 #include "llvm/Transforms/Utils/Cloning.h"
 
 #include "core/options.h"
+#include "core/stats.h"
 #include "core/types.h"
 
 #include "core/util.h"
@@ -40,7 +40,10 @@
 #include "codegen/compvars.h"
 #include "codegen/dis.h"
 #include "codegen/entry.h"
+#include "codegen/irgen/hooks.h"
 #include "codegen/memmgr.h"
+#include "codegen/object_cache.h"
+#include "codegen/tiering.h"
 #include "codegen/stackmaps.h"
 #include "codegen/profiling/profiling.h"
 
@@ -75,6 +78,10 @@ extern int STRIPPED_STDLIB_BC_SIZE;
 
 }
 
+// The stdlib's machine code is part of the binary (it gets compiled from the same bitcode), so
+// jitted code calls into it directly; this module is only for looking up the declarations and
+// types of runtime functions, and for inlining.  That means there's nothing to compile here, and
+// getting the module lazily means that only the functions that get inlined get parsed.
 static llvm::Module* loadStdlib() {
     Timer _t("to load stdlib");
 
@@ -108,51 +115,13 @@ static llvm::Module* loadStdlib() {
             I->setLinkage(llvm::GlobalVariable::ExternalLinkage);
     }
     m->setModuleIdentifier("  stdlib  ");
+
+    long us = _t.end();
+    static StatCounter us_loading_stdlib("us_loading_stdlib");
+    us_loading_stdlib.log(us);
     return m;
 }
 
-class MyObjectCache : public llvm::ObjectCache {
-    private:
-        bool loaded;
-    public:
-        MyObjectCache() : loaded(false) {}
-
-        virtual void notifyObjectCompiled(const llvm::Module *M, const llvm::MemoryBuffer *Obj) {}
-
-        virtual llvm::MemoryBuffer* getObject(const llvm::Module* M) {
-            assert(!loaded);
-            loaded = true;
-            g.engine->setObjectCache(NULL);
-            std::unique_ptr<MyObjectCache> del_at_end(this);
-
-#if 0
-            if (!USE_STRIPPED_STDLIB) {
-                stajt = STDLIB_CACHE_START;
-                size = (intptr_t)&STDLIB_CACHE_SIZE;
-            } else {
-                start = STRIPPED_STDLIB_CACHE_START;
-                size = (intptr_t)&STRIPPED_STDLIB_CACHE_SIZE;
-            }
-#else
-            RELEASE_ASSERT(0, "");
-            char* start = NULL;
-            intptr_t size = 0;
-#endif
-
-            // Make sure the stdlib got linked in correctly; check the magic number at the beginning:
-            assert(start[0] == 0x7f);
-            assert(start[1] == 'E');
-            assert(start[2] == 'L');
-            assert(start[3] == 'F');
-
-            assert(size > 0 && size < 1 << 30); // make sure the size is being loaded correctly
-
-            llvm::StringRef data(start, size);
-            return llvm::MemoryBuffer::getMemBufferCopy(data, "");
-        }
-
-};
-
 static void handle_sigfpe(int signum) {
     assert(signum == SIGFPE);
     fprintf(stderr, "ZeroDivisionError: integer division or modulo by zero\n");
@@ -166,6 +135,8 @@ void initCodegen() {
 
     g.stdlib_module = loadStdlib();
 
+    tiering::initTieringPolicy();
+
     llvm::EngineBuilder eb(new llvm::Module("empty_initial_module", g.context));
     eb.setEngineKind(llvm::EngineKind::JIT); // specify we only want the JIT, and not the interpreter fallback
     eb.setUseMCJIT(true);
@@ -185,7 +156,8 @@ void initCodegen() {
     g.engine = eb.create(g.tm);
     assert(g.engine && "engine creation failed?");
 
-    //g.engine->setObjectCache(new MyObjectCache());
+    if (OBJECT_CACHE_DIR)
+        g.engine->setObjectCache(createObjectCache(OBJECT_CACHE_DIR));
 
     g.i1 = llvm::Type::getInt1Ty(g.context);
     g.i8 = llvm::Type::getInt8Ty(g.context);
@@ -279,6 +251,8 @@ int joinRuntime() {
     // In the future this will have to wait for non-daemon
     // threads to finish
 
+    stopBackgroundCompiles();
+
     if (PROFILE)
         g.func_addr_registry.dumpPerfMap();
 
@@ -25,9 +25,12 @@ class ConservativeGCBuilder : public GCBuilder {
             assert(ptr_ptr->getType() == g.llvm_value_type_ptr);
             return emitter.getBuilder()->CreateLoad(ptr_ptr);
         }
-        virtual void writePointer(IREmitter& emitter, llvm::Value* ptr_ptr, llvm::Value* ptr_value, bool ignore_existing_value) {
+        virtual void writePointer(IREmitter& emitter, llvm::Value* holder, llvm::Value* ptr_ptr, llvm::Value* ptr_value, bool ignore_existing_value) {
             assert(ptr_ptr->getType() == g.llvm_value_type_ptr);
             emitter.getBuilder()->CreateStore(ptr_value, ptr_ptr);
+
+            llvm::Value* holder_i8 = emitter.getBuilder()->CreateBitCast(holder, g.i8_ptr);
+            emitter.getBuilder()->CreateCall(g.funcs.gcWriteBarrier, holder_i8);
         }
         virtual void grabPointer(IREmitter& emitter, llvm::Value* ptr) {
         }
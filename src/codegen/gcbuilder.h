@@ -25,7 +25,8 @@ class IREmitter;
 class GCBuilder {
     public:
         virtual llvm::Value* readPointer(IREmitter&, llvm::Value* ptr_ptr) = 0;
-        virtual void writePointer(IREmitter&, llvm::Value* ptr_ptr, llvm::Value* ptr_value, bool ignore_existing_value) = 0;
+        // holder is the object that contains ptr_ptr; it gets passed to the write barrier.
+        virtual void writePointer(IREmitter&, llvm::Value* holder, llvm::Value* ptr_ptr, llvm::Value* ptr_value, bool ignore_existing_value) = 0;
 
         virtual void grabPointer(IREmitter&, llvm::Value* ptr) = 0;
         virtual void dropPointer(IREmitter&, llvm::Value* ptr) = 0;
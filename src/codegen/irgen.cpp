@@ -41,6 +41,7 @@
 #include "codegen/patchpoints.h"
 #include "codegen/osrentry.h"
 #include "codegen/stackmaps.h"
+#include "codegen/tiering.h"
 #include "codegen/irgen/irgenerator.h"
 #include "codegen/irgen/util.h"
 #include "codegen/opt/escape_analysis.h"
@@ -73,7 +74,7 @@ static void addIRDebugSymbols(llvm::Function *f) {
 
     mpm.add(llvm::createDebugIRPass(false, false, ".debug_ir", f->getName()));
 
-    mpm.run(*g.cur_module);
+    mpm.run(*f->getParent());
 }
 
 static void optimizeIR(llvm::Function *f, EffortLevel::EffortLevel effort) {
@@ -84,7 +85,7 @@ static void optimizeIR(llvm::Function *f, EffortLevel::EffortLevel effort) {
 
     Timer _t("optimizing");
 
-    llvm::FunctionPassManager fpm(g.cur_module);
+    llvm::FunctionPassManager fpm(f->getParent());
 
     fpm.add(new llvm::DataLayout(*g.tm->getDataLayout()));
 
@@ -484,13 +485,6 @@ static void emitBBs(IRGenState* irstate, const char* bb_type, GuardList &out_gua
             // pass
         } else if (block->idx == 0) {
             assert(entry_descriptor == NULL);
-            // number of times a function needs to be called to be reoptimized:
-            static const int REOPT_THRESHOLDS[] = {
-                10,      // INTERPRETED->MINIMAL
-                250,     // MINIMAL->MODERATE
-                10000,   // MODERATE->MAXIMAL
-            };
-
             assert(strcmp("opt", bb_type) == 0);
 
             if (ENABLE_REOPT && effort < EffortLevel::MAXIMAL && source->ast != NULL && source->ast->type != AST_TYPE::Module) {
@@ -502,7 +496,9 @@ static void emitBBs(IRGenState* irstate, const char* bb_type, GuardList &out_gua
                 llvm::Value *cur_call_count = emitter->getBuilder()->CreateLoad(call_count_ptr);
                 llvm::Value *new_call_count = emitter->getBuilder()->CreateAdd(cur_call_count, getConstantInt(1, g.i64));
                 emitter->getBuilder()->CreateStore(new_call_count, call_count_ptr);
-                llvm::Value *reopt_test = emitter->getBuilder()->CreateICmpSGT(new_call_count, getConstantInt(REOPT_THRESHOLDS[effort], g.i64));
+                // number of times a function needs to be called to be reoptimized:
+                int64_t reopt_threshold = tiering::reoptThreshold(cf, source);
+                llvm::Value *reopt_test = emitter->getBuilder()->CreateICmpSGT(new_call_count, getConstantInt(reopt_threshold, g.i64));
 
                 llvm::Value* md_vals[] = {llvm::MDString::get(g.context, "branch_weights"), getConstantInt(1), getConstantInt(1000)};
                 llvm::MDNode* branch_weights = llvm::MDNode::get(g.context, llvm::ArrayRef<llvm::Value*>(md_vals));
@@ -948,18 +944,27 @@ CompiledFunction* compileFunction(SourceInfo *source, const OSREntryDescriptor *
     static StatCounter us_irgen("us_compiling_irgen");
     us_irgen.log(us);
 
+    g.cur_module = NULL;
+
+    return cf;
+}
+
+void optimizeCompiledFunction(CompiledFunction *cf) {
+    llvm::Function *f = cf->func;
+
     if (ENABLE_LLVMOPTS)
-        optimizeIR(f, effort);
+        optimizeIR(f, cf->effort);
+
+    // This has to run after the optimizations, since it depends on exactly which values are
+    // live across each patchpoint:
+    if (cf->effort > EffortLevel::INTERPRETED)
+        patchpoints::addGCRootOperands(f);
 
     bool ENABLE_IR_DEBUG = false;
     if (ENABLE_IR_DEBUG) {
         addIRDebugSymbols(f);
         //dumpPrettyIR(f);
     }
-
-    g.cur_module = NULL;
-
-    return cf;
 }
 
 
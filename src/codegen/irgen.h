@@ -66,6 +66,9 @@ class IREmitter {
 };
 
 CompiledFunction* compileFunction(SourceInfo *source, const OSREntryDescriptor *entry_descriptor, EffortLevel::EffortLevel effort, FunctionSignature *sig, const std::vector<AST_expr*> &arg_names, std::string nameprefix);
+// Runs the LLVM passes over the IR that compileFunction() generated.  Unlike the irgen, this
+// doesn't look at any runtime state, so it can run on the background compile thread.
+void optimizeCompiledFunction(CompiledFunction *cf);
 
 }
 
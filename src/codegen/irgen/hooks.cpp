@@ -12,6 +12,17 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <sys/time.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/Support/raw_ostream.h"
 
@@ -26,6 +37,7 @@
 
 #include "analysis/function_analysis.h"
 #include "analysis/scoping_analysis.h"
+#include "analysis/type_analysis.h"
 
 #include "asm_writing/icinfo.h"
 
@@ -33,12 +45,17 @@
 #include "codegen/compvars.h"
 #include "codegen/irgen.h"
 #include "codegen/llvm_interpreter.h"
+#include "codegen/object_cache.h"
 #include "codegen/osrentry.h"
 #include "codegen/stackmaps.h"
 #include "codegen/patchpoints.h"
+#include "codegen/reclaim.h"
+#include "codegen/tiering.h"
 #include "codegen/irgen/hooks.h"
 #include "codegen/irgen/util.h"
 
+#include "gc/collector.h"
+
 #include "runtime/gc_runtime.h"
 #include "runtime/objmodel.h"
 #include "runtime/types.h"
@@ -91,7 +108,20 @@ const std::vector<AST_stmt*>& SourceInfo::getBody() {
     }
 }
 
-static void compileIR(CompiledFunction* cf, EffortLevel::EffortLevel effort) {
+// Reopts can get handed off to a background thread (see -B), so that a hot function keeps
+// running at its current tier instead of stopping for what can be a multi-millisecond compile.
+// The irgen still happens on the main thread, since it looks at runtime state, but the LLVM
+// passes and the machine code generation (most of the time of a MAXIMAL compile) happen on the
+// compile thread.  The main thread then installs the new version the next time it gets into
+// reoptCompiledFunc() or compilePartialFunc().
+//
+// None of LLVM is thread-safe, so anything that uses it holds codegen_lock; that means there can only be one compile going on at a time, which is why
+// there's just the one compile thread.
+static std::recursive_mutex codegen_lock;
+
+// Generates the machine code for cf, and returns its stackmap, which needs to get processed
+// before the code can be run.
+static StackMap* compileIR(CompiledFunction* cf, EffortLevel::EffortLevel effort) {
     assert(cf);
     assert(cf->func);
 
@@ -104,6 +134,8 @@ static void compileIR(CompiledFunction* cf, EffortLevel::EffortLevel effort) {
     void* compiled = NULL;
     if (effort > EffortLevel::INTERPRETED) {
         Timer _t("to jit the IR");
+        if (OBJECT_CACHE_DIR)
+            prepareForObjectCache(cf->func);
         g.engine->addModule(cf->func->getParent());
         compiled = (void*)g.engine->getFunctionAddress(cf->func->getName());
         assert(compiled);
@@ -125,12 +157,20 @@ static void compileIR(CompiledFunction* cf, EffortLevel::EffortLevel effort) {
     }
 
     StackMap *stackmap = parseStackMap();
-    patchpoints::processStackmap(stackmap);
+    if (OBJECT_CACHE_DIR && effort > EffortLevel::INTERPRETED)
+        finishObjectCacheCompile(stackmap);
+    if (effort > EffortLevel::INTERPRETED)
+        takeJittedCode(cf);
+    return stackmap;
 }
 
 // Compiles a new version of the function with the given signature and adds it to the list;
 // should only be called after checking to see if the other versions would work.
-static CompiledFunction* _doCompile(CLFunction *f, FunctionSignature *sig, EffortLevel::EffortLevel effort, const OSREntryDescriptor *entry) {
+// If in_background is set, this only does the irgen, and the caller has to hand the result to
+// the compile thread, which will finish compiling it.
+static CompiledFunction* _doCompile(CLFunction *f, FunctionSignature *sig, EffortLevel::EffortLevel effort, const OSREntryDescriptor *entry, bool in_background=false) {
+    std::lock_guard<std::recursive_mutex> lock(codegen_lock);
+
     Timer _t("for _doCompile()");
     assert(sig);
 
@@ -174,11 +214,16 @@ static CompiledFunction* _doCompile(CLFunction *f, FunctionSignature *sig, Effor
 
     CompiledFunction *cf = compileFunction(source, entry, effort, sig, arg_names, name);
 
-    compileIR(cf, effort);
-    f->addVersion(cf);
-    assert(f->versions.size());
+    if (!in_background) {
+        optimizeCompiledFunction(cf);
+        patchpoints::processStackmap(cf, compileIR(cf, effort));
+        f->addVersion(cf);
+        assert(f->versions.size());
+    }
 
     long us = _t.end();
+    if (!in_background)
+        tiering::noteCompile(cf, us);
     static StatCounter us_compiling("us_compiling");
     us_compiling.log(us);
     static StatCounter num_compiles("num_compiles");
@@ -247,9 +292,14 @@ CompiledFunction* compileModule(AST_Module *m, BoxedModule *bm) {
     return cf;
 }
 
-/// Reoptimizes the given function version at the new effort level.
+/// Reoptimizes the given function version at the new effort level (which can be the same
+/// level, to recompile it without a speculation that failed).
 /// The cf must be an active version in its parents CLFunction; the given
 /// version will be replaced by the new version, which will be returned.
+// Versions that have been replaced by a reopt, and what they were replaced with.  Code that
+// still calls the old version directly gets forwarded to the new one by reoptCompiledFunc().
+static std::unordered_map<CompiledFunction*, CompiledFunction*> replaced_versions;
+
 static CompiledFunction* _doReopt(CompiledFunction *cf, EffortLevel::EffortLevel new_effort) {
     assert(cf->clfunc->versions.size());
 
@@ -260,7 +310,7 @@ static CompiledFunction* _doReopt(CompiledFunction *cf, EffortLevel::EffortLevel
     CLFunction *clfunc = cf->clfunc;
     assert(clfunc);
 
-    assert(new_effort > cf->effort);
+    assert(new_effort >= cf->effort);
 
     FunctionList &versions = clfunc->versions;
     for (int i = 0; i < versions.size(); i++) {
@@ -269,7 +319,9 @@ static CompiledFunction* _doReopt(CompiledFunction *cf, EffortLevel::EffortLevel
 
             CompiledFunction *new_cf = _doCompile(clfunc, cf->sig, new_effort, NULL); // this pushes the new CompiledVersion to the back of the version list
 
+            replaced_versions[cf] = new_cf;
             cf->dependent_callsites.invalidateAll();
+            retireVersion(cf);
 
             return new_cf;
         }
@@ -278,6 +330,160 @@ static CompiledFunction* _doReopt(CompiledFunction *cf, EffortLevel::EffortLevel
     abort();
 }
 
+namespace {
+struct BackgroundCompile {
+    // The version that's getting replaced, and the irgen'd replacement:
+    CompiledFunction *old_cf, *new_cf;
+    StackMap *stackmap;
+    timeval queued_time;
+    // How long the compile thread spent on it:
+    long us;
+};
+
+// The compile thread.  It gets stopped at exit (see stopBackgroundCompiles()), but this never
+// gets freed.
+struct CompileThread {
+    std::mutex lock;
+    std::condition_variable cv;
+    // Everything below is protected by the lock:
+    // The compiles waiting for the thread (the front one is the one it's working on), and the
+    // ones that it's finished, which are waiting for the main thread to install them.
+    std::deque<BackgroundCompile*> queue;
+    std::vector<BackgroundCompile*> finished;
+    // How long the thread has spent compiling since the main thread last checked:
+    long us = 0;
+    bool stopping = false;
+};
+}
+static CompileThread* compile_thread = NULL;
+// The versions that have a reopt in the queue:
+static std::unordered_set<CompiledFunction*> pending_reopts;
+
+static void compileThreadMain() {
+    CompileThread &t = *compile_thread;
+    std::unique_lock<std::mutex> lock(t.lock);
+    while (true) {
+        t.cv.wait(lock, [&t]() { return !t.queue.empty() || t.stopping; });
+        if (t.queue.empty())
+            return;
+        BackgroundCompile* bc = t.queue.front();
+        lock.unlock();
+
+        timeval start, end;
+        gettimeofday(&start, NULL);
+        {
+            std::lock_guard<std::recursive_mutex> codegen(codegen_lock);
+            optimizeCompiledFunction(bc->new_cf);
+            bc->stackmap = compileIR(bc->new_cf, bc->new_cf->effort);
+        }
+        gettimeofday(&end, NULL);
+        bc->us = 1000000L * (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec);
+
+        lock.lock();
+        t.queue.pop_front();
+        t.finished.push_back(bc);
+        t.us += bc->us;
+        t.cv.notify_all();
+    }
+}
+
+void stopBackgroundCompiles() {
+    if (!compile_thread)
+        return;
+
+    CompileThread &t = *compile_thread;
+    std::unique_lock<std::mutex> lock(t.lock);
+    t.stopping = true;
+    // Let the thread finish the compile that it's in the middle of, but not start any others:
+    if (t.queue.size() > 1)
+        t.queue.resize(1);
+    t.cv.notify_all();
+    t.cv.wait(lock, [&t]() { return t.queue.empty(); });
+}
+
+static void queueBackgroundReopt(CompiledFunction *cf, EffortLevel::EffortLevel new_effort) {
+    static StatCounter sc_queued("background_compiles_queued");
+    static StatCounter sc_queue_length("background_compile_queue_length");
+
+    assert(cf->entry_descriptor == NULL && "We can't reopt an osr-entry compile!");
+    assert(!pending_reopts.count(cf));
+
+    BackgroundCompile* bc = new BackgroundCompile();
+    bc->old_cf = cf;
+    bc->new_cf = _doCompile(cf->clfunc, cf->sig, new_effort, NULL, true);
+    bc->stackmap = NULL;
+    bc->us = 0;
+    gettimeofday(&bc->queued_time, NULL);
+    pending_reopts.insert(cf);
+
+    if (!compile_thread) {
+        compile_thread = new CompileThread();
+        std::thread(compileThreadMain).detach();
+    }
+    {
+        std::lock_guard<std::mutex> lock(compile_thread->lock);
+        compile_thread->queue.push_back(bc);
+        // Logged every time something gets queued, so the average length is this over sc_queued:
+        sc_queue_length.log(compile_thread->queue.size());
+    }
+    compile_thread->cv.notify_all();
+    sc_queued.log();
+}
+
+// Replaces the versions that the compile thread has finished reopting.  This has to happen on
+// the main thread, since it changes the version lists and invalidates ICs.
+static void installBackgroundCompiles() {
+    static StatCounter sc_installed("background_compiles_installed");
+    static StatCounter sc_latency("us_background_compile_latency");
+    static StatCounter sc_thread_us("us_background_compiling");
+
+    if (!compile_thread)
+        return;
+
+    std::vector<BackgroundCompile*> finished;
+    {
+        std::lock_guard<std::mutex> lock(compile_thread->lock);
+        finished.swap(compile_thread->finished);
+        sc_thread_us.log(compile_thread->us);
+        compile_thread->us = 0;
+    }
+
+    for (BackgroundCompile* bc : finished) {
+        CompiledFunction *old_cf = bc->old_cf, *new_cf = bc->new_cf;
+        patchpoints::processStackmap(new_cf, bc->stackmap);
+
+        CLFunction *clfunc = old_cf->clfunc;
+        FunctionList &versions = clfunc->versions;
+        FunctionList::iterator it = std::find(versions.begin(), versions.end(), old_cf);
+        assert(it != versions.end());
+        versions.erase(it);
+        clfunc->addVersion(new_cf);
+        assert(!new_cf->is_interpreted);
+        tiering::noteCompile(new_cf, bc->us);
+
+        pending_reopts.erase(old_cf);
+        replaced_versions[old_cf] = new_cf;
+        old_cf->dependent_callsites.invalidateAll();
+        retireVersion(old_cf);
+
+        timeval now;
+        gettimeofday(&now, NULL);
+        sc_latency.log(1000000L * (now.tv_sec - bc->queued_time.tv_sec) + (now.tv_usec - bc->queued_time.tv_usec));
+        sc_installed.log();
+
+        if (VERBOSITY("irgen") >= 1) printf("Installed background reopt of %p as %p\n", old_cf, new_cf);
+        delete bc;
+    }
+}
+
+// Frees the superseded versions that have finished running.  If the compile thread is in the
+// middle of a compile, this gets put off until the next time rather than waiting for it.
+static void tryReclaimRetiredVersions() {
+    std::unique_lock<std::recursive_mutex> lock(codegen_lock, std::try_to_lock);
+    if (lock.owns_lock())
+        reclaimRetiredVersions();
+}
+
 static StatCounter stat_osrexits("OSR exits");
 void* compilePartialFunc(OSRExit* exit) {
     assert(exit);
@@ -287,14 +493,13 @@ void* compilePartialFunc(OSRExit* exit) {
 
     //if (VERBOSITY("irgen") >= 1) printf("In compilePartialFunc, handling %p\n", exit);
 
+    installBackgroundCompiles();
+    tryReclaimRetiredVersions();
+
     assert(exit->parent_cf->clfunc);
     CompiledFunction* &new_cf = exit->parent_cf->clfunc->osr_versions[exit->entry];
     if (new_cf == NULL) {
-        EffortLevel::EffortLevel new_effort = EffortLevel::MAXIMAL;
-        if (exit->parent_cf->effort == EffortLevel::INTERPRETED)
-            new_effort = EffortLevel::MINIMAL;
-        //EffortLevel::EffortLevel new_effort = (EffortLevel::EffortLevel)(exit->parent_cf->effort + 1);
-        //new_effort = EffortLevel::MAXIMAL;
+        EffortLevel::EffortLevel new_effort = tiering::osrEffort(exit);
         CompiledFunction *compiled = _doCompile(exit->parent_cf->clfunc, exit->parent_cf->sig, new_effort, exit->entry);
         assert(compiled = new_cf);
     }
@@ -302,18 +507,120 @@ void* compilePartialFunc(OSRExit* exit) {
     return new_cf->code;
 }
 
+// While its background reopt is pending, a function checks back on it (by calling
+// reoptCompiledFunc() again) every this many calls:
+static const int64_t BACKGROUND_REOPT_POLL_CALLS = 50;
+
 static StatCounter stat_reopt("reopts");
 extern "C" char* reoptCompiledFunc(CompiledFunction *cf) {
     if (VERBOSITY("irgen") >= 1) printf("In reoptCompiledFunc, %p, %ld\n", cf, cf->times_called);
-    stat_reopt.log();
+
+    installBackgroundCompiles();
+    tryReclaimRetiredVersions();
+
+    if (replaced_versions.count(cf)) {
+        CompiledFunction *new_cf = cf;
+        while (replaced_versions.count(new_cf))
+            new_cf = replaced_versions[new_cf];
+        return (char*)new_cf->code;
+    }
 
     assert(cf->effort < EffortLevel::MAXIMAL);
+
+    bool pending = pending_reopts.count(cf);
+    EffortLevel::EffortLevel new_effort = cf->effort;
+    if (!pending) {
+        new_effort = tiering::reoptEffort(cf);
+        // The calls were too spread out to be worth it; the policy has decayed the call count, so
+        // this will get called again if they pick up.
+        if (new_effort == cf->effort)
+            return (char*)cf->code;
+    }
+
+    // Interpreted versions don't have any code to keep running, and the MINIMAL compile that
+    // replaces them is quick anyway.
+    if (BACKGROUND_COMPILE && cf->effort > EffortLevel::INTERPRETED) {
+        if (!pending) {
+            stat_reopt.log();
+            queueBackgroundReopt(cf, new_effort);
+        }
+
+        // Keep running this version for now; the caller will call it again, which has to get
+        // past the reopt check this time.
+        cf->times_called = std::max(0L, cf->times_called - BACKGROUND_REOPT_POLL_CALLS);
+        return (char*)cf->code;
+    }
+
+    stat_reopt.log();
+
     assert(cf->clfunc->versions.size());
-    CompiledFunction *new_cf = _doReopt(cf, (EffortLevel::EffortLevel(cf->effort + 1)));
+    CompiledFunction *new_cf = _doReopt(cf, new_effort);
     assert(!new_cf->is_interpreted);
     return (char*)new_cf->code;
 }
 
+// How many times a speculation guard can fail before the function gets recompiled without that
+// speculation.  Until then, each failure runs the rest of the function in the unspeculated
+// version that irgen puts next to the speculated one.
+static const int64_t DEOPT_THRESHOLD = 100;
+
+extern "C" void speculationFailed(SpeculationSite* site) {
+    static StatCounter sc_failures("speculation_failures");
+    sc_failures.log();
+
+    site->failures++;
+    if (site->failures != DEOPT_THRESHOLD)
+        return;
+
+    CompiledFunction *cf = site->cf;
+    assert(cf->clfunc);
+    SourceInfo *source = cf->clfunc->source;
+    assert(source);
+
+    static StatCounter sc_deopts("deopts");
+    sc_deopts.log();
+    // These only get made once a site reaches the threshold, which happens at most once per site
+    // (and once it's full, the stats table counts any more in stats_overflow):
+    std::string stat_name = "deopts_" + source->getName();
+    StatCounter(stat_name).log();
+    std::ostringstream site_stat_name;
+    site_stat_name << stat_name << "_line" << site->node->lineno << "_col" << site->node->col_offset;
+    StatCounter(site_stat_name.str()).log();
+
+    if (VERBOSITY("irgen") >= 1) {
+        printf("Speculation at %s:%d:%d failed %ld times; disabling it\n", source->getName().c_str(), site->node->lineno, site->node->col_offset, site->failures);
+    }
+    disableSpeculation(site->node);
+
+    installBackgroundCompiles();
+    tryReclaimRetiredVersions();
+
+    if (cf->entry_descriptor != NULL) {
+        // OSR compiles can't be replaced, but they can be dropped, so that the next exit
+        // compiles a new one:
+        CompiledFunction* &osr_cf = cf->clfunc->osr_versions[cf->entry_descriptor];
+        if (osr_cf == cf) {
+            static StatCounter sc_osr_dropped("deopts_osr_versions_dropped");
+            sc_osr_dropped.log();
+            osr_cf = NULL;
+            retireVersion(cf);
+        }
+        return;
+    }
+
+    // Module code doesn't get run again, and versions that are already getting replaced will be
+    // left alone; their replacements get their own SpeculationSites.
+    if (source->ast->type == AST_TYPE::Module || replaced_versions.count(cf) || pending_reopts.count(cf))
+        return;
+
+    static StatCounter sc_recompiles("deopts_recompiled");
+    sc_recompiles.log();
+    if (BACKGROUND_COMPILE)
+        queueBackgroundReopt(cf, cf->effort);
+    else
+        _doReopt(cf, cf->effort);
+}
+
 CompiledFunction* resolveCLFunc(CLFunction *f, int64_t nargs, Box* arg1, Box* arg2, Box* arg3, Box** args) {
     static StatCounter slowpath_resolveclfunc("slowpath_resolveclfunc");
     slowpath_resolveclfunc.log();
@@ -422,6 +729,125 @@ CompiledFunction* resolveCLFunc(CLFunction *f, int64_t nargs, Box* arg1, Box* ar
     return cf;
 }
 
+// Calls that don't go through a patched IC (because the call site's IC slots are all in use, or
+// the caller is the interpreter or C++ code) get a per-call-site cache of what resolveCLFunc()
+// picked.  Like a patched IC, each entry guards on the function and the argument classes, and
+// depends on the version it points to, so it gets redone once that version gets reopted.
+// The caches only get used by the thread that runs Python code, so they aren't locked.
+// Looking a call site up costs about as much as resolveCLFunc() checking two versions, so
+// functions with fewer versions than CALLSITE_CACHE_MIN_VERSIONS don't use the caches.
+#define CALLSITE_CACHE_ENTRIES 4
+#define CALLSITE_CACHE_MAX_ARGS 6
+#define CALLSITE_CACHE_MIN_VERSIONS 3
+
+namespace {
+struct CallsiteCacheEntry {
+    CLFunction *clfunc;
+    int64_t nargs;
+    BoxedClass* arg_classes[CALLSITE_CACHE_MAX_ARGS];
+    CompiledFunction *cf;
+    // cf->dependent_callsites.version() when the entry was made:
+    int64_t cf_version;
+};
+
+struct CallsiteCache {
+    CallsiteCacheEntry entries[CALLSITE_CACHE_ENTRIES];
+    // The entry to replace next, if none of them are stale:
+    int next;
+
+    CallsiteCache() : next(0) {
+        memset(entries, 0, sizeof(entries));
+    }
+};
+}
+static std::unordered_map<void*, CallsiteCache*> callsite_caches;
+
+// The entries don't keep their classes alive, so the entries for classes that a collection
+// found dead have to go before the classes get freed (and their addresses reused):
+static void dropDeadCallsiteCacheEntries() {
+    for (auto it : callsite_caches) {
+        for (CallsiteCacheEntry &e : it.second->entries) {
+            for (int i = 0; i < e.nargs && e.cf; i++) {
+                BoxedClass* cls = e.arg_classes[i];
+                if (gc::isHeapPointer(cls) && !gc::isMarked(gc::headerFromObject(cls)))
+                    e.cf = NULL;
+            }
+        }
+    }
+}
+
+void dropCallsiteCaches(void* start, void* end) {
+    for (auto it = callsite_caches.begin(); it != callsite_caches.end();) {
+        if (it->first > start && it->first <= end) {
+            delete it->second;
+            it = callsite_caches.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+CompiledFunction* resolveCLFuncForCallsite(void* callsite, CLFunction *f, int64_t nargs, Box* arg1, Box* arg2, Box* arg3, Box** args) {
+    if (callsite == NULL || nargs > CALLSITE_CACHE_MAX_ARGS || f->versions.size() < CALLSITE_CACHE_MIN_VERSIONS)
+        return resolveCLFunc(f, nargs, arg1, arg2, arg3, args);
+
+#ifndef NDEBUG
+    static const std::thread::id owner = std::this_thread::get_id();
+    assert(std::this_thread::get_id() == owner);
+#endif
+    static bool registered_hook = false;
+    if (!registered_hook) {
+        gc::registerPostMarkHook(dropDeadCallsiteCacheEntries);
+        registered_hook = true;
+    }
+
+    static StatCounter sc_hits("callsite_cache_hits");
+    static StatCounter sc_misses("callsite_cache_misses");
+
+    BoxedClass* arg_classes[CALLSITE_CACHE_MAX_ARGS];
+    for (int i = 0; i < nargs; i++) {
+        if (i == 0) arg_classes[i] = arg1->cls;
+        else if (i == 1) arg_classes[i] = arg2->cls;
+        else if (i == 2) arg_classes[i] = arg3->cls;
+        else arg_classes[i] = args[i-3]->cls;
+    }
+
+    CallsiteCache* &cache = callsite_caches[callsite];
+    if (cache == NULL)
+        cache = new CallsiteCache();
+
+    CallsiteCacheEntry *replace = NULL;
+    for (int i = 0; i < CALLSITE_CACHE_ENTRIES; i++) {
+        CallsiteCacheEntry &e = cache->entries[i];
+        if (e.cf == NULL || e.cf->dependent_callsites.version() != e.cf_version) {
+            if (!replace)
+                replace = &e;
+            continue;
+        }
+        if (e.clfunc != f || e.nargs != nargs)
+            continue;
+        if (memcmp(e.arg_classes, arg_classes, nargs * sizeof(BoxedClass*)) != 0)
+            continue;
+
+        sc_hits.log();
+        return e.cf;
+    }
+
+    sc_misses.log();
+    CompiledFunction *cf = resolveCLFunc(f, nargs, arg1, arg2, arg3, args);
+
+    if (!replace) {
+        replace = &cache->entries[cache->next];
+        cache->next = (cache->next + 1) % CALLSITE_CACHE_ENTRIES;
+    }
+    replace->clfunc = f;
+    replace->nargs = nargs;
+    memcpy(replace->arg_classes, arg_classes, nargs * sizeof(BoxedClass*));
+    replace->cf = cf;
+    replace->cf_version = cf->dependent_callsites.version();
+    return cf;
+}
+
 Box* callCompiledFunc(CompiledFunction *cf, int64_t nargs, Box* arg1, Box* arg2, Box* arg3, Box**args) {
     assert(cf);
 
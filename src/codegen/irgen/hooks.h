@@ -17,10 +17,27 @@
 
 namespace pyston {
 
+class AST_expr;
 class OSRExit;
 void* compilePartialFunc(OSRExit*);
 extern "C" char* reoptCompiledFunc(CompiledFunction*);
 
+// A type speculation that some jitted code guards on.  When the guard fails, the code reports it
+// to speculationFailed() on its way into the unspeculated (deopt) version of the rest of the
+// function.
+struct SpeculationSite {
+    CompiledFunction *cf;
+    AST_expr *node;
+    int64_t failures;
+
+    SpeculationSite(CompiledFunction *cf, AST_expr *node) : cf(cf), node(node), failures(0) {}
+};
+extern "C" void speculationFailed(SpeculationSite* site);
+
+// Waits for the background compile thread to finish whatever it's compiling, and drops the
+// rest of its queue; this has to happen before LLVM gets torn down.
+void stopBackgroundCompiles();
+
 }
 
 #endif
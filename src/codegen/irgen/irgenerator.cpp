@@ -22,8 +22,11 @@
 #include "codegen/compvars.h"
 #include "codegen/osrentry.h"
 #include "codegen/patchpoints.h"
+#include "codegen/tiering.h"
+#include "codegen/type_recording.h"
 
 #include "codegen/irgen.h"
+#include "codegen/irgen/hooks.h"
 #include "codegen/irgen/irgenerator.h"
 #include "codegen/irgen/util.h"
 
@@ -211,6 +214,21 @@ class IRGeneratorImpl : public IRGenerator {
             out_guards.addExprTypeGuard(myblock, guard, node, node_value, symbol_table);
         }
 
+        // Points the failure edge of an out-guard (from the "opt" version) at target, through a
+        // block that reports the failure (see speculationFailed()).
+        void connectGuardFailure(GuardList::ExprTypeGuard* guard, llvm::BasicBlock* target) {
+            llvm::BasicBlock* failed_bb = llvm::BasicBlock::Create(g.context, "guard_failed", irstate->getLLVMFunction());
+            llvm::IRBuilderBase::InsertPoint ip = emitter.getBuilder()->saveIP();
+
+            emitter.getBuilder()->SetInsertPoint(failed_bb);
+            SpeculationSite* site = new SpeculationSite(irstate->getCurFunction(), guard->ast_node);
+            emitter.getBuilder()->CreateCall(g.funcs.speculationFailed, embedConstantPtr(site, g.i8_ptr));
+            emitter.getBuilder()->CreateBr(target);
+
+            emitter.getBuilder()->restoreIP(ip);
+            guard->branch->setSuccessor(1, failed_bb);
+        }
+
         CompilerVariable* evalAttribute(AST_Attribute *node) {
             assert(node->ctx_type == AST_TYPE::Load);
             CompilerVariable *value = evalExpr(node->value);
@@ -980,6 +998,18 @@ class IRGeneratorImpl : public IRGenerator {
                 assert(state == PARTIAL);
             }
 
+            // Type feedback for the higher tiers:
+            if (rtn != NULL && ENABLE_SPECULATION && irstate->getEffortLevel() < EffortLevel::MODERATE) {
+                if (node->type == AST_TYPE::Attribute || node->type == AST_TYPE::BinOp || node->type == AST_TYPE::Call || node->type == AST_TYPE::Subscript) {
+                    // Only values that are already boxed, and whose class isn't known statically:
+                    ConcreteCompilerType *t = rtn->getConcreteType();
+                    if (rtn->getType() == t && t->llvmType() == g.llvm_value_type_ptr && t->guaranteedClass() == NULL) {
+                        llvm::Value* recorder = embedConstantPtr(getTypeRecorderForNode(node), g.i8_ptr);
+                        emitter.getBuilder()->CreateCall2(g.funcs.recordType, recorder, static_cast<ConcreteCompilerVariable*>(rtn)->getValue());
+                    }
+                }
+            }
+
             // Out-guarding:
             BoxedClass *speculated_class = types->speculatedExprClass(node);
             if (speculated_class != NULL && state != PARTIAL) {
@@ -1017,7 +1047,7 @@ class IRGeneratorImpl : public IRGenerator {
                     printf("; is_partial=%d\n", state == PARTIAL);
                 }
                 if (state == PARTIAL) {
-                    guard->branch->setSuccessor(1, curblock);
+                    connectGuardFailure(guard, curblock);
                     symbol_table = SymbolTable(guard->st);
                     assert(guard->val);
                     state = RUNNING;
@@ -1071,7 +1101,7 @@ class IRGeneratorImpl : public IRGenerator {
                     emitter.getBuilder()->SetInsertPoint(ramp_block);
                     emitter.getBuilder()->CreateBr(join_block);
 
-                    guard->branch->setSuccessor(1, ramp_block);
+                    connectGuardFailure(guard, ramp_block);
 
                     {
                         ConcreteCompilerType *this_merged_type = rtn->getConcreteType();
@@ -1427,16 +1457,16 @@ class IRGeneratorImpl : public IRGenerator {
             llvm::BasicBlock *starting_block = curblock;
             llvm::BasicBlock *onramp = llvm::BasicBlock::Create(g.context, "onramp", irstate->getLLVMFunction());
 
+            OSRExit* exit = new OSRExit(irstate->getCurFunction(), OSREntryDescriptor::create(irstate->getCurFunction(), osr_key));
+
             // Code to check if we want to do the OSR:
-            llvm::GlobalVariable* edgecount_ptr = new llvm::GlobalVariable(*g.cur_module, g.i64, false, llvm::GlobalValue::InternalLinkage, getConstantInt(0, g.i64), "edgecount");
+            llvm::Value* edgecount_ptr = embedConstantPtr(&exit->backedges, g.i64->getPointerTo());
             llvm::Value* curcount = emitter.getBuilder()->CreateLoad(edgecount_ptr);
             llvm::Value* newcount = emitter.getBuilder()->CreateAdd(curcount, getConstantInt(1, g.i64));
             emitter.getBuilder()->CreateStore(newcount, edgecount_ptr);
 
-            int OSR_THRESHOLD = 10000;
-            if (irstate->getEffortLevel() == EffortLevel::INTERPRETED)
-                OSR_THRESHOLD = 100;
-            llvm::Value* osr_test = emitter.getBuilder()->CreateICmpSGT(newcount, getConstantInt(OSR_THRESHOLD));
+            int64_t osr_threshold = tiering::osrThreshold(irstate->getCurFunction());
+            llvm::Value* osr_test = emitter.getBuilder()->CreateICmpSGT(newcount, getConstantInt(osr_threshold, g.i64));
 
             llvm::Value* md_vals[] = {llvm::MDString::get(g.context, "branch_weights"), getConstantInt(1), getConstantInt(1000)};
             llvm::MDNode* branch_weights = llvm::MDNode::get(g.context, llvm::ArrayRef<llvm::Value*>(md_vals));
@@ -1444,7 +1474,6 @@ class IRGeneratorImpl : public IRGenerator {
 
             // Emitting the actual OSR:
             emitter.getBuilder()->SetInsertPoint(onramp);
-            OSRExit* exit = new OSRExit(irstate->getCurFunction(), OSREntryDescriptor::create(irstate->getCurFunction(), osr_key));
             llvm::Value* partial_func = emitter.getBuilder()->CreateCall(g.funcs.compilePartialFunc, embedConstantPtr(exit, g.i8->getPointerTo()));
 
             std::vector<llvm::Value*> llvm_args;
@@ -216,16 +216,27 @@ void gatherInterpreterRootsForFrame(GCVisitor *visitor, void* frame_ptr) {
     }
 }
 
+// How many frames are interpreting each function:
+static std::unordered_map<llvm::Function*, int> interpreted_functions;
+bool isBeingInterpreted(llvm::Function *f) {
+    return interpreted_functions.count(f) != 0;
+}
+
 class UnregisterHelper {
     private:
         void* frame_ptr;
+        llvm::Function* f;
 
     public:
-        constexpr UnregisterHelper(void* frame_ptr) : frame_ptr(frame_ptr) {}
+        constexpr UnregisterHelper(void* frame_ptr, llvm::Function* f) : frame_ptr(frame_ptr), f(f) {}
 
         ~UnregisterHelper() {
             assert(interpreter_roots.count(frame_ptr));
             interpreter_roots.erase(frame_ptr);
+
+            assert(interpreted_functions.count(f));
+            if (--interpreted_functions[f] == 0)
+                interpreted_functions.erase(f);
         }
 };
 
@@ -249,7 +260,8 @@ Box* interpretFunction(llvm::Function *f, int nargs, Box* arg1, Box* arg2, Box*
 
     void* frame_ptr = __builtin_frame_address(0);
     interpreter_roots[frame_ptr] = &symbols;
-    UnregisterHelper helper(frame_ptr);
+    interpreted_functions[f]++;
+    UnregisterHelper helper(frame_ptr, f);
 
     int i = 0;
     for (llvm::Function::arg_iterator AI = f->arg_begin(), end = f->arg_end(); AI != end; AI++, i++) {
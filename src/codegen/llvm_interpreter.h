@@ -26,6 +26,8 @@ class GCVisitor;
 
 void gatherInterpreterRootsForFrame(GCVisitor *visitor, void* frame_ptr);
 Box* interpretFunction(llvm::Function *f, int nargs, Box* arg1, Box* arg2, Box* arg3, Box* *args);
+// Whether there's a frame on the stack that's interpreting f:
+bool isBeingInterpreted(llvm::Function *f);
 
 }
 
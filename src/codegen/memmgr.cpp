@@ -24,6 +24,7 @@
 #include "core/util.h"
 
 #include "codegen/memmgr.h"
+#include "codegen/object_cache.h"
 
 // This code was copy-pasted from SectionMemoryManager.cpp;
 // TODO eventually I should remove this using directive
@@ -34,7 +35,7 @@ namespace pyston {
 
 class PystonMemoryManager : public RTDyldMemoryManager {
     public:
-        PystonMemoryManager() { }
+        PystonMemoryManager() : pending(NULL) { }
         virtual ~PystonMemoryManager();
 
         virtual uint8_t *allocateCodeSection(uintptr_t Size, unsigned Alignment,
@@ -50,6 +51,12 @@ class PystonMemoryManager : public RTDyldMemoryManager {
 
         virtual void invalidateInstructionCache();
 
+        virtual void registerEHFrames(uint8_t *Addr, uint64_t LoadAddr, size_t Size);
+        virtual void deregisterEHFrames(uint8_t *Addr, uint64_t LoadAddr, size_t Size);
+
+        CodeMemory* takeCodeMemory();
+        void releaseCodeMemory(CodeMemory* mem);
+
     private:
         struct MemoryGroup {
             SmallVector<sys::MemoryBlock, 16> AllocatedMem;
@@ -63,13 +70,20 @@ class PystonMemoryManager : public RTDyldMemoryManager {
         error_code applyMemoryGroupPermissions(MemoryGroup &MemGroup,
                 unsigned Permissions);
 
+        static bool isAllocated(const MemoryGroup &MemGroup, void* Addr);
+
         virtual uint64_t getSymbolAddress(const std::string &Name);
 
         MemoryGroup CodeMem;
         MemoryGroup RWDataMem;
         MemoryGroup RODataMem;
+
+        // What's been allocated for the object that's currently getting jitted:
+        CodeMemory* pending;
 };
 
+static PystonMemoryManager* memory_manager = NULL;
+
 uint8_t *PystonMemoryManager::allocateDataSection(uintptr_t Size,
         unsigned Alignment,
         unsigned SectionID,
@@ -141,6 +155,10 @@ uint8_t *PystonMemoryManager::allocateSection(MemoryGroup &MemGroup,
     MemGroup.Near = MB;
 
     MemGroup.AllocatedMem.push_back(MB);
+    if (!pending)
+        pending = new CodeMemory();
+    pending->blocks.push_back(MB);
+    pending->total_size += MB.size();
     Addr = (uintptr_t)MB.base();
     uintptr_t EndOfBlock = Addr + MB.size();
 
@@ -191,6 +209,10 @@ bool PystonMemoryManager::finalizeMemory(std::string *ErrMsg)
 
     // Read-write data memory already has the correct permissions
 
+    // pyston: don't let the next object share any of the mappings either, so that they can be
+    // unmapped separately (see releaseCodeMemory()).
+    RWDataMem.FreeMem.clear();
+
     // Some platforms with separate data cache and instruction cache require
     // explicit cache flush, otherwise JIT code manipulations (like resolved
     // relocations) will get to the data cache but not to the instruction cache.
@@ -224,6 +246,9 @@ uint64_t PystonMemoryManager::getSymbolAddress(const std::string &name) {
     uint64_t base = RTDyldMemoryManager::getSymbolAddress(name);
     if (base) return base;
 
+    base = getObjectCacheSymbolAddress(name);
+    if (base) return base;
+
     if (startswith(name, "__PRETTY_FUNCTION__")) {
         return getSymbolAddress(".L" + name);
     }
@@ -232,6 +257,85 @@ uint64_t PystonMemoryManager::getSymbolAddress(const std::string &name) {
     return 0;
 }
 
+void PystonMemoryManager::registerEHFrames(uint8_t *Addr, uint64_t LoadAddr, size_t Size) {
+    RTDyldMemoryManager::registerEHFrames(Addr, LoadAddr, Size);
+    if (!pending)
+        pending = new CodeMemory();
+    pending->eh_frames.push_back(std::make_pair(Addr, Size));
+}
+
+void PystonMemoryManager::deregisterEHFrames(uint8_t *Addr, uint64_t LoadAddr, size_t Size) {
+    // This only gets called directly when the ExecutionEngine gets destroyed; skip the frames
+    // of objects that have already been released.
+    if (isAllocated(CodeMem, Addr) || isAllocated(RWDataMem, Addr) || isAllocated(RODataMem, Addr))
+        RTDyldMemoryManager::deregisterEHFrames(Addr, LoadAddr, Size);
+}
+
+bool PystonMemoryManager::isAllocated(const MemoryGroup &MemGroup, void* Addr) {
+    for (const sys::MemoryBlock &MB : MemGroup.AllocatedMem) {
+        if (MB.base() <= Addr && Addr < (uint8_t*)MB.base() + MB.size())
+            return true;
+    }
+    return false;
+}
+
+CodeMemory* PystonMemoryManager::takeCodeMemory() {
+    CodeMemory* rtn = pending;
+    pending = NULL;
+    return rtn;
+}
+
+static void removeBlock(SmallVectorImpl<sys::MemoryBlock> &blocks, const sys::MemoryBlock &MB) {
+    for (int i = 0, e = blocks.size(); i != e; ++i) {
+        if (blocks[i].base() == MB.base()) {
+            blocks.erase(blocks.begin() + i);
+            return;
+        }
+    }
+}
+
+void PystonMemoryManager::releaseCodeMemory(CodeMemory* mem) {
+    for (const std::pair<uint8_t*, size_t> &p : mem->eh_frames)
+        RTDyldMemoryManager::deregisterEHFrames(p.first, (uint64_t)p.first, p.second);
+
+    for (const sys::MemoryBlock &MB : mem->blocks) {
+        removeBlock(CodeMem.AllocatedMem, MB);
+        removeBlock(RWDataMem.AllocatedMem, MB);
+        removeBlock(RODataMem.AllocatedMem, MB);
+        // Don't allocate anything "near" memory that's about to go away; it's only a hint, but
+        // it's better to not keep hinting at a hole.
+        if (CodeMem.Near.base() == MB.base())
+            CodeMem.Near = sys::MemoryBlock();
+        if (RWDataMem.Near.base() == MB.base())
+            RWDataMem.Near = sys::MemoryBlock();
+        if (RODataMem.Near.base() == MB.base())
+            RODataMem.Near = sys::MemoryBlock();
+
+        sys::MemoryBlock block = MB;
+        error_code ec = sys::Memory::releaseMappedMemory(block);
+        RELEASE_ASSERT(!ec, "%s", ec.message().c_str());
+    }
+    delete mem;
+}
+
+bool CodeMemory::contains(void* addr) const {
+    for (const sys::MemoryBlock &MB : blocks) {
+        if (MB.base() <= addr && addr < (uint8_t*)MB.base() + MB.size())
+            return true;
+    }
+    return false;
+}
+
+CodeMemory* takeCodeMemory() {
+    assert(memory_manager);
+    return memory_manager->takeCodeMemory();
+}
+
+void releaseCodeMemory(CodeMemory* mem) {
+    assert(memory_manager);
+    memory_manager->releaseCodeMemory(mem);
+}
+
 PystonMemoryManager::~PystonMemoryManager() {
     for (unsigned i = 0, e = CodeMem.AllocatedMem.size(); i != e; ++i)
         sys::Memory::releaseMappedMemory(CodeMem.AllocatedMem[i]);
@@ -242,7 +346,9 @@ PystonMemoryManager::~PystonMemoryManager() {
 }
 
 llvm::RTDyldMemoryManager* createMemoryManager() {
-    return new PystonMemoryManager();
+    assert(memory_manager == NULL && "the code lifetime tracking assumes there's only one");
+    memory_manager = new PystonMemoryManager();
+    return memory_manager;
 }
 
 }
@@ -15,12 +15,38 @@
 #ifndef PYSTON_CODEGEN_MEMMGR_H
 #define PYSTON_CODEGEN_MEMMGR_H
 
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "llvm/Support/Memory.h"
+
 namespace llvm {
 class RTDyldMemoryManager;
 }
 
 namespace pyston {
 llvm::RTDyldMemoryManager* createMemoryManager();
+
+// The memory that the sections of one jitted object got put in.  Each object gets its own
+// mappings, so they can be unmapped once its code is dead.
+struct CodeMemory {
+    std::vector<llvm::sys::MemoryBlock> blocks;
+    // The registered eh frames, as (address, size):
+    std::vector<std::pair<uint8_t*, size_t> > eh_frames;
+    size_t total_size;
+
+    CodeMemory() : total_size(0) {}
+
+    bool contains(void* addr) const;
+};
+
+// Hands over the memory that got allocated since the last call, ie for the object that was just
+// jitted.  Has to be called with the codegen lock held, right after each jit.
+CodeMemory* takeCodeMemory();
+// Deregisters the eh frames and unmaps the memory; the code must not be on the stack anymore.
+void releaseCodeMemory(CodeMemory* mem);
 }
 
 #endif
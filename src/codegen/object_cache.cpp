@@ -0,0 +1,308 @@
+// Copyright (c) 2014 Dropbox, Inc.
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//    http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InstIterator.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+#include "core/common.h"
+#include "core/stats.h"
+#include "core/util.h"
+
+#include "codegen/codegen.h"
+#include "codegen/object_cache.h"
+#include "codegen/stackmaps.h"
+
+namespace pyston {
+
+#define CONSTANT_SYMBOL_PREFIX "__pyston_const_"
+
+namespace {
+// The module that's being compiled through the cache.  Compiles are serialized by the codegen
+// lock (see hooks.cpp), so there's only ever one of these at a time.
+struct PreparedModule {
+    const llvm::Module* module = NULL;
+    // The cache key, which is also the new name of the function:
+    std::string key;
+    // The addresses that the CONSTANT_SYMBOL_PREFIX symbols stand for:
+    std::vector<uint64_t> constants;
+    // The real ids of the patchpoints, indexed by the ids that they got compiled with:
+    std::vector<int64_t> patchpoint_ids;
+};
+}
+static PreparedModule prepared;
+
+// Replaces embedded pointers (see embedConstantPtr()) with references to external symbols.
+class ConstantSymbolMaterializer : public llvm::ValueMaterializer {
+    private:
+        llvm::Module* module;
+        std::unordered_map<uint64_t, llvm::GlobalVariable*> symbols;
+    public:
+        ConstantSymbolMaterializer(llvm::Module* module) : module(module) {
+        }
+
+        virtual llvm::Value* materializeValueFor(llvm::Value* v) {
+            llvm::ConstantExpr *ce = llvm::dyn_cast<llvm::ConstantExpr>(v);
+            if (!ce || ce->getOpcode() != llvm::Instruction::IntToPtr)
+                return NULL;
+            llvm::ConstantInt* addr_const = llvm::dyn_cast<llvm::ConstantInt>(ce->getOperand(0));
+            // LLVM assumes that a global's address isn't null, so leave nulls as they are:
+            if (!addr_const || addr_const->isZero())
+                return NULL;
+            uint64_t addr = addr_const->getZExtValue();
+
+            llvm::GlobalVariable* &sym = symbols[addr];
+            if (!sym) {
+                std::ostringstream name;
+                name << CONSTANT_SYMBOL_PREFIX << prepared.constants.size();
+                // Zero-sized, so that nothing can assume that it's safe to load from:
+                llvm::ArrayType* t = llvm::ArrayType::get(g.i8, 0);
+                sym = new llvm::GlobalVariable(*module, t, false, llvm::GlobalValue::ExternalLinkage, NULL, name.str());
+                prepared.constants.push_back(addr);
+            }
+            return llvm::ConstantExpr::getPointerCast(sym, ce->getType());
+        }
+};
+
+static bool isPatchpoint(llvm::Instruction* inst) {
+    llvm::IntrinsicInst* ii = llvm::dyn_cast<llvm::IntrinsicInst>(inst);
+    if (!ii)
+        return false;
+    return ii->getIntrinsicID() == llvm::Intrinsic::experimental_patchpoint_i64
+        || ii->getIntrinsicID() == llvm::Intrinsic::experimental_patchpoint_void;
+}
+
+// Identifies the build of pyston that generated a cached object, since the code refers to
+// runtime functions by address, and to the runtime's data structures by layout.
+static const std::string& getBuildId() {
+    static std::string build_id;
+    if (build_id.empty()) {
+        struct stat exe_stat;
+        int code = stat("/proc/self/exe", &exe_stat);
+        RELEASE_ASSERT(code == 0, "");
+
+        std::ostringstream os;
+        os << STRINGIFY(GITREV) << ' ' << STRINGIFY(LLVMREV) << ' ' << exe_stat.st_size << ' '
+            << exe_stat.st_mtim.tv_sec << '.' << exe_stat.st_mtim.tv_nsec;
+        build_id = os.str();
+    }
+    return build_id;
+}
+
+// Function names end in a counter (see getUniqueFunctionName()); OSR compiles also have the
+// name of the function that they're exiting from.  Neither is the same from run to run.
+static std::string getStableName(const std::string &name) {
+    std::string rtn = name;
+    size_t last = rtn.rfind('_');
+    if (last != std::string::npos && last + 1 < rtn.size() && rtn.find_first_not_of("0123456789", last + 1) == std::string::npos)
+        rtn = rtn.substr(0, last);
+    return rtn.substr(0, rtn.find("_from_"));
+}
+
+void prepareForObjectCache(llvm::Function* f) {
+    Timer _t("to prepare for the object cache");
+
+    assert(prepared.module == NULL);
+    llvm::Module* m = f->getParent();
+    prepared.module = m;
+
+    // Patchpoint ids are allocated from a global counter, so renumber them in the order that
+    // they show up in:
+    std::unordered_map<int64_t, int64_t> local_ids;
+    for (llvm::inst_iterator it = inst_begin(f), end = inst_end(f); it != end; ++it) {
+        if (!isPatchpoint(&*it))
+            continue;
+
+        llvm::CallInst* call = llvm::cast<llvm::CallInst>(&*it);
+        int64_t pp_id = llvm::cast<llvm::ConstantInt>(call->getArgOperand(0))->getSExtValue();
+        if (!local_ids.count(pp_id)) {
+            local_ids[pp_id] = prepared.patchpoint_ids.size();
+            prepared.patchpoint_ids.push_back(pp_id);
+        }
+        call->setArgOperand(0, llvm::ConstantInt::get(g.i64, local_ids[pp_id]));
+    }
+
+    llvm::ValueToValueMapTy vmap;
+    ConstantSymbolMaterializer materializer(m);
+    for (llvm::inst_iterator it = inst_begin(f), end = inst_end(f); it != end; ++it) {
+        bool is_patchpoint = isPatchpoint(&*it);
+        for (int i = 0; i < it->getNumOperands(); i++) {
+            // The call target of a patchpoint has to be a constant, since it gets emitted as an
+            // immediate.  They're always runtime functions, which are covered by the build id
+            // (if the binary is position-independent, they'll cause cache misses).
+            if (is_patchpoint && i == 2)
+                continue;
+
+            llvm::Value* op = it->getOperand(i);
+            if (!llvm::isa<llvm::ConstantExpr>(op))
+                continue;
+            it->setOperand(i, llvm::MapValue(op, vmap, llvm::RF_None, NULL, &materializer));
+        }
+    }
+
+    std::string name = f->getName().str();
+    std::string ir;
+    llvm::raw_string_ostream os(ir);
+    m->print(os, NULL);
+    os.flush();
+
+    // The name also shows up in the debug info, so take it out of the IR that gets hashed:
+    for (size_t pos = ir.find(name); pos != std::string::npos; pos = ir.find(name, pos))
+        ir.erase(pos, name.size());
+
+    llvm::MD5 hasher;
+    hasher.update(getBuildId());
+    hasher.update(ir);
+    llvm::MD5::MD5Result hash;
+    hasher.final(hash);
+    llvm::SmallString<32> hash_str;
+    llvm::MD5::stringifyResult(hash, hash_str);
+
+    // Identical functions can get compiled more than once, but the symbol names have to be
+    // unique:
+    static std::unordered_map<std::string, int> times_used;
+    std::string key = getStableName(name) + "_" + hash_str.str().str();
+    int n = ++times_used[key];
+    if (n > 1) {
+        std::ostringstream key_os;
+        key_os << key << '_' << n;
+        key = key_os.str();
+    }
+
+    f->setName(key);
+    assert(f->getName() == key);
+    m->setModuleIdentifier(key);
+    prepared.key = key;
+}
+
+void finishObjectCacheCompile(StackMap* stackmap) {
+    assert(prepared.module);
+
+    int nrecords = stackmap ? stackmap->records.size() : 0;
+    for (int i = 0; i < nrecords; i++) {
+        StackMap::Record* r = stackmap->records[i];
+        assert(r->id < prepared.patchpoint_ids.size());
+        r->id = prepared.patchpoint_ids[r->id];
+    }
+
+    prepared = PreparedModule();
+}
+
+uint64_t getObjectCacheSymbolAddress(const std::string &name) {
+    if (!startswith(name, CONSTANT_SYMBOL_PREFIX))
+        return 0;
+
+    int idx = atoi(name.c_str() + strlen(CONSTANT_SYMBOL_PREFIX));
+    RELEASE_ASSERT(prepared.module && idx < prepared.constants.size(), "%s", name.c_str());
+    return prepared.constants[idx];
+}
+
+class PersistentObjectCache : public llvm::ObjectCache {
+    private:
+        const std::string dir;
+
+        std::string getPath(const std::string &key) {
+            return dir + "/" + key + ".o";
+        }
+
+    public:
+        PersistentObjectCache(const std::string &dir) : dir(dir) {
+            llvm::error_code code = llvm::sys::fs::create_directory(dir, true);
+            RELEASE_ASSERT(!code, "couldn't create the object cache directory %s", dir.c_str());
+        }
+
+        virtual void notifyObjectCompiled(const llvm::Module *M, const llvm::MemoryBuffer *Obj) {
+            static StatCounter sc_stored("object_cache_stores");
+
+            if (M != prepared.module)
+                return;
+
+            // Write it to a temporary file and then move that into place, so that other
+            // processes that share the cache never see a partially-written object:
+            std::string path = getPath(prepared.key);
+            std::ostringstream tmp_path;
+            tmp_path << path << ".tmp" << getpid();
+
+            // The cache is just an optimization, so failing to write to it isn't an error:
+            FILE* f = fopen(tmp_path.str().c_str(), "wb");
+            if (!f)
+                return;
+            size_t written = fwrite(Obj->getBufferStart(), 1, Obj->getBufferSize(), f);
+            int code = fclose(f);
+            if (written != Obj->getBufferSize() || code != 0 || rename(tmp_path.str().c_str(), path.c_str()) != 0) {
+                unlink(tmp_path.str().c_str());
+                return;
+            }
+            sc_stored.log();
+        }
+
+        virtual llvm::MemoryBuffer* getObject(const llvm::Module* M) {
+            static StatCounter sc_hits("object_cache_hits");
+            static StatCounter sc_misses("object_cache_misses");
+
+            // This gets called for every module, including ones that didn't go through
+            // prepareForObjectCache():
+            if (M != prepared.module)
+                return NULL;
+
+            std::string path = getPath(prepared.key);
+            FILE* f = fopen(path.c_str(), "rb");
+            if (!f) {
+                sc_misses.log();
+                return NULL;
+            }
+
+            std::string data;
+            char buf[4096];
+            while (size_t nread = fread(buf, 1, sizeof(buf), f)) {
+                data.append(buf, nread);
+            }
+            fclose(f);
+
+            // Check the ELF magic number, just in case:
+            if (data.size() < 4 || memcmp(data.data(), "\x7f" "ELF", 4) != 0) {
+                sc_misses.log();
+                return NULL;
+            }
+
+            if (VERBOSITY("irgen") >= 1) printf("Loading %s from the object cache\n", prepared.key.c_str());
+            sc_hits.log();
+            return llvm::MemoryBuffer::getMemBufferCopy(data, path);
+        }
+};
+
+llvm::ObjectCache* createObjectCache(const std::string &dir) {
+    return new PersistentObjectCache(dir);
+}
+
+}
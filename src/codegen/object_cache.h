@@ -0,0 +1,53 @@
+// Copyright (c) 2014 Dropbox, Inc.
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//    http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PYSTON_CODEGEN_OBJECTCACHE_H
+#define PYSTON_CODEGEN_OBJECTCACHE_H
+
+#include <cstdint>
+#include <string>
+
+namespace llvm {
+class Function;
+class ObjectCache;
+}
+
+namespace pyston {
+
+struct StackMap;
+
+// The persistent cache of the machine code of jitted functions (see -C).
+//
+// Jitted code refers to runtime objects by their addresses, which change from run to run, so
+// before a function gets compiled, prepareForObjectCache() replaces those addresses with
+// symbols that get resolved when the code gets loaded.  The cache key is a hash of the IR that
+// results from that, so cached code only gets used for a function that's the same down to the
+// IR (which covers its AST, signature and effort level), other than those addresses.
+llvm::ObjectCache* createObjectCache(const std::string &dir);
+
+// Rewrites f's module so that it can be compiled through the cache, and renames f after its
+// cache key.  Has to be called right before the module gets compiled, and
+// finishObjectCacheCompile() right after.
+void prepareForObjectCache(llvm::Function* f);
+// Translates the patchpoint ids in the stackmap back to the ones that the patchpoints were
+// registered with, which prepareForObjectCache() had replaced.
+void finishObjectCacheCompile(StackMap* stackmap);
+
+// For the memory manager: the address of one of the symbols that prepareForObjectCache()
+// replaced an address with, or 0 if this isn't one of those.
+uint64_t getObjectCacheSymbolAddress(const std::string &name);
+
+}
+
+#endif
@@ -46,8 +46,10 @@ class OSRExit {
     public:
         CompiledFunction * const parent_cf;
         OSREntryDescriptor *entry;
+        // How many times the backedge has been taken; the code increments this directly:
+        int64_t backedges;
 
-        OSRExit(CompiledFunction *parent_cf, OSREntryDescriptor *entry) : parent_cf(parent_cf), entry(entry) {
+        OSRExit(CompiledFunction *parent_cf, OSREntryDescriptor *entry) : parent_cf(parent_cf), entry(entry), backedges(0) {
         }
 };
 
@@ -12,8 +12,19 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <memory>
+#include <mutex>
 #include <unordered_map>
+#include <unordered_set>
+
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Target/TargetMachine.h"
 
 #include "core/common.h"
 #include "core/options.h"
@@ -22,9 +33,12 @@
 
 #include "asm_writing/icinfo.h"
 
+#include "codegen/codegen.h"
 #include "codegen/patchpoints.h"
 #include "codegen/stackmaps.h"
 
+#include "gc/root_finder.h"
+
 namespace pyston {
 
 int PatchpointSetupInfo::totalSize() const {
@@ -39,9 +53,15 @@ int64_t PatchpointSetupInfo::getPatchpointId() const {
     return pp_id;
 }
 
+// The patchpoints of the functions that haven't been through processStackmap() yet.  There can
+// be several of those at once, with one of them on the background compile thread, so this
+// has its own lock.
 static std::unordered_map<int64_t, PatchpointSetupInfo*> new_patchpoints_by_id;
+static std::mutex new_patchpoints_lock;
 
 PatchpointSetupInfo* PatchpointSetupInfo::initialize(bool has_return_value, int num_slots, int slot_size, CompiledFunction *parent_cf, patchpoints::PatchpointType type) {
+    std::lock_guard<std::mutex> lock(new_patchpoints_lock);
+
     static int64_t next_id = 100;
     int64_t id = next_id++;
 
@@ -50,9 +70,52 @@ PatchpointSetupInfo* PatchpointSetupInfo::initialize(bool has_return_value, int
     return rtn;
 }
 
+static PatchpointSetupInfo* getNewPatchpoint(int64_t id) {
+    std::lock_guard<std::mutex> lock(new_patchpoints_lock);
+    auto it = new_patchpoints_by_id.find(id);
+    assert(it != new_patchpoints_by_id.end());
+    return it->second;
+}
+
 namespace patchpoints {
 
-void processStackmap(StackMap* stackmap) {
+static void registerGCRoots(StackMap* stackmap, StackMap::Record* r, int first_location, PatchpointSetupInfo* pp, uint8_t* start_addr) {
+    gc::PreciseFrameRoots* roots = new gc::PreciseFrameRoots();
+    roots->num_stack_args = pp->num_gc_stack_args;
+
+    int idx = first_location;
+    for (int size : pp->gc_slot_sizes) {
+        const StackMap::Record::Location &l = r->locations[idx++];
+        assert(l.type == 2); // "Direct"
+        roots->locations.push_back(gc::FrameRootLocation({gc::FrameRootLocation::Direct, l.regnum, l.offset, size}));
+    }
+
+    for (int i = 0; i < pp->num_gc_values; i++) {
+        const StackMap::Record::Location &l = r->locations[idx++];
+        switch (l.type) {
+            case 1: // "Register"
+                roots->locations.push_back(gc::FrameRootLocation({gc::FrameRootLocation::Register, l.regnum, 0, 0}));
+                break;
+            case 2: // "Direct"; this is an address into one of the stack slots, which are already covered
+                break;
+            case 3: // "Indirect"
+                roots->locations.push_back(gc::FrameRootLocation({gc::FrameRootLocation::Indirect, l.regnum, l.offset, 0}));
+                break;
+            case 4: // "Constant"
+                roots->locations.push_back(gc::FrameRootLocation({gc::FrameRootLocation::Constant, 0, l.offset, 0}));
+                break;
+            case 5: // "ConstantIndex"
+                roots->locations.push_back(gc::FrameRootLocation({gc::FrameRootLocation::Constant, 0, (int64_t)stackmap->constants[l.offset], 0}));
+                break;
+            default:
+                RELEASE_ASSERT(0, "%d", l.type);
+        }
+    }
+
+    gc::registerPreciseFrameRoots(start_addr, start_addr + pp->totalSize(), roots);
+}
+
+void processStackmap(CompiledFunction* cf, StackMap* stackmap) {
     int nrecords = stackmap ? stackmap->records.size() : 0;
 
     for (int i = 0; i < nrecords; i++) {
@@ -62,14 +125,13 @@ void processStackmap(StackMap* stackmap) {
         const StackMap::StackSizeRecord &stack_size_record = stackmap->stack_size_records[0];
         int stack_size = stack_size_record.stack_size;
 
-        PatchpointSetupInfo* pp = new_patchpoints_by_id[r->id];
-        assert(pp);
+        PatchpointSetupInfo* pp = getNewPatchpoint(r->id);
+        assert(pp->parent_cf == cf);
 
         bool has_scratch = (pp->numScratchBytes() != 0);
         int scratch_rbp_offset = 0;
+        int num_locations = 0;
         if (has_scratch) {
-            assert(r->locations.size() == 1);
-
             StackMap::Record::Location l = r->locations[0];
 
             static const int DWARF_RBP_REGNUM = 6;
@@ -77,14 +139,20 @@ void processStackmap(StackMap* stackmap) {
             assert(l.type == 2); // "Direct"
             assert(l.regnum == DWARF_RBP_REGNUM);
             scratch_rbp_offset = l.offset;
-        } else {
-            assert(r->locations.size() == 0);
+            num_locations++;
         }
 
         uint8_t* func_addr = (uint8_t*)pp->parent_cf->code;
         assert(func_addr);
         uint8_t* start_addr = func_addr + r->offset;
 
+        if (pp->has_gc_roots) {
+            assert(r->locations.size() == num_locations + pp->gc_slot_sizes.size() + pp->num_gc_values);
+            registerGCRoots(stackmap, r, num_locations, pp, start_addr);
+        } else {
+            assert(r->locations.size() == num_locations);
+        }
+
         std::unordered_set<int> live_outs;
         for (auto live_out : r->live_outs) {
             live_outs.insert(live_out.regnum);
@@ -104,11 +172,186 @@ void processStackmap(StackMap* stackmap) {
         registerCompiledPatchpoint(start_addr, pp, StackInfo({stack_size, has_scratch, pp->numScratchBytes(), scratch_rbp_offset}), std::move(live_outs));
     }
 
+    std::lock_guard<std::mutex> lock(new_patchpoints_lock);
     for (std::unordered_map<int64_t, PatchpointSetupInfo*>::iterator it =
-            new_patchpoints_by_id.begin(), end = new_patchpoints_by_id.end(); it != end; ++it) {
-        delete it->second;
+            new_patchpoints_by_id.begin(); it != new_patchpoints_by_id.end();) {
+        if (it->second->parent_cf == cf) {
+            delete it->second;
+            it = new_patchpoints_by_id.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+typedef std::unordered_set<llvm::Value*> ValueSet;
+
+// Whether the value might be (or contain) a pointer into the gc heap.  Pointers sometimes
+// get passed around as i64's, such as the return values of patchpoints.
+static bool isPotentialGCPointer(llvm::Value* v) {
+    if (!llvm::isa<llvm::Instruction>(v) && !llvm::isa<llvm::Argument>(v))
+        return false;
+    // The stack slots get handled separately:
+    if (llvm::isa<llvm::AllocaInst>(v))
+        return false;
+    llvm::Type* t = v->getType();
+    return t->isPointerTy() || t->isIntegerTy(64);
+}
+
+static bool isPatchpoint(llvm::Instruction* inst) {
+    llvm::IntrinsicInst* ii = llvm::dyn_cast<llvm::IntrinsicInst>(inst);
+    if (!ii)
+        return false;
+    return ii->getIntrinsicID() == llvm::Intrinsic::experimental_patchpoint_i64
+        || ii->getIntrinsicID() == llvm::Intrinsic::experimental_patchpoint_void;
+}
+
+// Updates `live` from being the set of values live after inst to being the set live before it.
+// Phi operands are treated as being used at the end of the corresponding predecessor.
+static void stepBackwards(llvm::Instruction* inst, ValueSet &live) {
+    live.erase(inst);
+    if (llvm::isa<llvm::PHINode>(inst))
+        return;
+    for (llvm::Value* op : inst->operands()) {
+        if (isPotentialGCPointer(op))
+            live.insert(op);
+    }
+}
+
+static ValueSet liveOut(llvm::BasicBlock* bb, std::unordered_map<llvm::BasicBlock*, ValueSet> &live_in) {
+    ValueSet rtn;
+    for (auto it = llvm::succ_begin(bb), end = llvm::succ_end(bb); it != end; ++it) {
+        llvm::BasicBlock* succ = *it;
+        ValueSet &succ_live = live_in[succ];
+        rtn.insert(succ_live.begin(), succ_live.end());
+
+        for (llvm::BasicBlock::iterator inst = succ->begin(); llvm::isa<llvm::PHINode>(inst); ++inst) {
+            llvm::Value* v = llvm::cast<llvm::PHINode>(inst)->getIncomingValueForBlock(bb);
+            if (isPotentialGCPointer(v))
+                rtn.insert(v);
+        }
+    }
+    return rtn;
+}
+
+void addGCRootOperands(llvm::Function* f) {
+    std::vector<llvm::AllocaInst*> slots;
+    std::vector<llvm::CallInst*> patchpoint_calls;
+    std::unordered_map<int64_t, int> calls_per_id;
+    std::unordered_map<llvm::Value*, int> order;
+
+    int next_order = 0;
+    for (llvm::Function::arg_iterator it = f->arg_begin(), end = f->arg_end(); it != end; ++it) {
+        order[&*it] = next_order++;
+    }
+    for (llvm::Function::iterator bb = f->begin(), bend = f->end(); bb != bend; ++bb) {
+        for (llvm::BasicBlock::iterator inst = bb->begin(), iend = bb->end(); inst != iend; ++inst) {
+            order[&*inst] = next_order++;
+
+            if (llvm::AllocaInst* alloca = llvm::dyn_cast<llvm::AllocaInst>(inst)) {
+                // We wouldn't know where a dynamically-sized slot is, so leave the whole
+                // function to the conservative scanner:
+                if (!alloca->isStaticAlloca())
+                    return;
+                slots.push_back(alloca);
+            } else if (isPatchpoint(&*inst)) {
+                llvm::CallInst* call = llvm::cast<llvm::CallInst>(inst);
+                patchpoint_calls.push_back(call);
+                calls_per_id[llvm::cast<llvm::ConstantInt>(call->getArgOperand(0))->getSExtValue()]++;
+            }
+        }
+    }
+
+    if (patchpoint_calls.empty())
+        return;
+
+    std::vector<int> slot_sizes;
+    const llvm::DataLayout* dl = g.tm->getDataLayout();
+    for (llvm::AllocaInst* alloca : slots) {
+        int64_t count = llvm::cast<llvm::ConstantInt>(alloca->getArraySize())->getSExtValue();
+        slot_sizes.push_back(dl->getTypeAllocSize(alloca->getAllocatedType()) * count);
+    }
+
+    // Standard backwards liveness analysis, iterated to a fixed point.
+    // The sets only ever grow, so comparing sizes is enough to detect changes.
+    std::unordered_map<llvm::BasicBlock*, ValueSet> live_in;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (llvm::Function::iterator bb = f->end(), bbegin = f->begin(); bb != bbegin;) {
+            --bb;
+            ValueSet live = liveOut(&*bb, live_in);
+            for (llvm::BasicBlock::iterator inst = bb->end(), ibegin = bb->begin(); inst != ibegin;) {
+                --inst;
+                stepBackwards(&*inst, live);
+            }
+
+            ValueSet &prev = live_in[&*bb];
+            if (live.size() != prev.size()) {
+                prev = std::move(live);
+                changed = true;
+            }
+        }
+    }
+
+    static StatCounter num_gc_root_operands("num_gc_root_operands");
+    std::unordered_map<llvm::Value*, llvm::Value*> replaced;
+    for (llvm::CallInst* pp_call : patchpoint_calls) {
+        int64_t pp_id = llvm::cast<llvm::ConstantInt>(pp_call->getArgOperand(0))->getSExtValue();
+        // If the optimizer duplicated the patchpoint, the copies can have different live values;
+        // just let those get scanned conservatively.
+        if (calls_per_id[pp_id] != 1)
+            continue;
+
+        PatchpointSetupInfo* pp = getNewPatchpoint(pp_id);
+
+        // The liveness sets were computed before we started replacing patchpoints:
+        llvm::BasicBlock* bb = pp_call->getParent();
+        ValueSet live;
+        for (llvm::Value* v : liveOut(bb, live_in)) {
+            live.insert(replaced.count(v) ? replaced[v] : v);
+        }
+        for (llvm::BasicBlock::iterator inst = bb->end();;) {
+            --inst;
+            if (&*inst == pp_call)
+                break;
+            stepBackwards(&*inst, live);
+        }
+        live.erase(pp_call);
+
+        std::vector<llvm::Value*> live_values(live.begin(), live.end());
+        std::sort(live_values.begin(), live_values.end(), [&order](llvm::Value* a, llvm::Value* b) {
+            return order[a] < order[b];
+        });
+
+        std::vector<llvm::Value*> args;
+        for (int i = 0; i < pp_call->getNumArgOperands(); i++) {
+            args.push_back(pp_call->getArgOperand(i));
+        }
+        args.insert(args.end(), slots.begin(), slots.end());
+        args.insert(args.end(), live_values.begin(), live_values.end());
+
+        static const int NUM_ARG_REGS = 6;
+        int num_call_args = llvm::cast<llvm::ConstantInt>(pp_call->getArgOperand(3))->getSExtValue();
+        pp->has_gc_roots = true;
+        pp->num_gc_stack_args = std::max(0, num_call_args - NUM_ARG_REGS);
+        pp->gc_slot_sizes = slot_sizes;
+        pp->num_gc_values = live_values.size();
+        num_gc_root_operands.log(slots.size() + live_values.size());
+
+        llvm::CallInst* new_call = llvm::CallInst::Create(pp_call->getCalledValue(), args, "", pp_call);
+        new_call->setCallingConv(pp_call->getCallingConv());
+        new_call->setAttributes(pp_call->getAttributes());
+        new_call->takeName(pp_call);
+        pp_call->replaceAllUsesWith(new_call);
+        replaced[pp_call] = new_call;
+        order[new_call] = order[pp_call];
+    }
+
+    // Don't erase these until the end, so that their addresses can't get reused:
+    for (auto &p : replaced) {
+        llvm::cast<llvm::Instruction>(p.first)->eraseFromParent();
     }
-    new_patchpoints_by_id.clear();
 }
 
 PatchpointSetupInfo* createGenericPatchpoint(CompiledFunction *parent_cf, bool has_return_value, int size) {
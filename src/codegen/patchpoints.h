@@ -17,9 +17,14 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <vector>
 
 #include "llvm/IR/CallingConv.h"
 
+namespace llvm {
+class Function;
+}
+
 namespace pyston {
 
 namespace patchpoints {
@@ -43,7 +48,8 @@ class CompiledFunction;
 class PatchpointSetupInfo {
     private:
         PatchpointSetupInfo(int64_t pp_id, patchpoints::PatchpointType type, int num_slots, int slot_size, CompiledFunction* parent_cf, bool has_return_value) :
-            pp_id(pp_id), type(type), num_slots(num_slots), slot_size(slot_size), has_return_value(has_return_value), parent_cf(parent_cf) {
+            pp_id(pp_id), type(type), num_slots(num_slots), slot_size(slot_size), has_return_value(has_return_value), parent_cf(parent_cf),
+            has_gc_roots(false), num_gc_stack_args(0), num_gc_values(0) {
         }
 
         const int64_t pp_id;
@@ -55,6 +61,13 @@ class PatchpointSetupInfo {
         CompiledFunction * const parent_cf;
         void* metadata;
 
+        // Filled in by addGCRootOperands(): the stack slots and live values that got appended
+        // to the patchpoint's operands (after the scratch space, if any).
+        bool has_gc_roots;
+        int num_gc_stack_args;
+        std::vector<int> gc_slot_sizes;
+        int num_gc_values;
+
         int totalSize() const;
         int64_t getPatchpointId() const;
         bool hasReturnValue() const { return has_return_value; }
@@ -77,7 +90,13 @@ struct StackMap;
 
 namespace patchpoints {
 
-void processStackmap(StackMap* stackmap);
+// Registers cf's patchpoints, now that cf has been compiled to machine code.
+void processStackmap(CompiledFunction* cf, StackMap* stackmap);
+
+// Adds the function's stack slots, and the values that are live across each patchpoint,
+// as extra stackmap operands of the patchpoints; processStackmap() then registers
+// them with the gc so that it can scan those frames precisely.
+void addGCRootOperands(llvm::Function* f);
 
 PatchpointSetupInfo* createGenericPatchpoint(CompiledFunction* parent_cf, bool has_return_value, int size);
 PatchpointSetupInfo* createCallsitePatchpoint(CompiledFunction* parent_cf, int num_args);
@@ -0,0 +1,174 @@
+// Copyright (c) 2014 Dropbox, Inc.
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//    http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define UNW_LOCAL_ONLY
+#include <libunwind.h>
+
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+
+#include "core/common.h"
+#include "core/stats.h"
+#include "core/types.h"
+
+#include "asm_writing/icinfo.h"
+
+#include "codegen/codegen.h"
+#include "codegen/llvm_interpreter.h"
+#include "codegen/memmgr.h"
+#include "codegen/osrentry.h"
+#include "codegen/reclaim.h"
+
+#include "gc/root_finder.h"
+
+namespace pyston {
+
+static StatCounter sc_code_bytes_live("code_memory_bytes_live");
+static StatCounter sc_code_bytes_freed("code_memory_bytes_freed");
+
+// Protected by the codegen lock, since the compile thread adds to it:
+static std::unordered_map<CompiledFunction*, CodeMemory*> code_memory;
+static std::unordered_set<CompiledFunction*> pinned_code;
+static std::vector<CompiledFunction*> retired_versions;
+
+void takeJittedCode(CompiledFunction* cf) {
+    assert(cf->code);
+    assert(!code_memory.count(cf));
+
+    CodeMemory* mem = takeCodeMemory();
+    assert(mem);
+    code_memory[cf] = mem;
+    sc_code_bytes_live.log(mem->total_size);
+
+    // Keep the declaration, since OSR compiles get named after the function they exit from:
+    cf->func->deleteBody();
+    static StatCounter sc_bodies("ir_function_bodies_freed");
+    sc_bodies.log();
+}
+
+void pinCode(CompiledFunction* cf) {
+    pinned_code.insert(cf);
+}
+
+void retireVersion(CompiledFunction* cf) {
+    static StatCounter sc_retired("versions_retired");
+    sc_retired.log();
+
+    assert(std::find(retired_versions.begin(), retired_versions.end(), cf) == retired_versions.end());
+    retired_versions.push_back(cf);
+}
+
+static bool isOnStack(CompiledFunction* cf, const std::vector<void*> &return_addrs) {
+    if (cf->is_interpreted)
+        return isBeingInterpreted(cf->func);
+
+    CodeMemory* mem = code_memory[cf];
+    assert(mem);
+    for (void* ip : return_addrs) {
+        // These are return addresses, so look at the call instruction before them:
+        if (mem->contains((char*)ip - 1))
+            return true;
+    }
+    return false;
+}
+
+static void freeVersion(CompiledFunction* cf) {
+    CLFunction* clfunc = cf->clfunc;
+
+    if (pinned_code.count(cf)) {
+        // Its code can still get called, and OSR out of its loops; that needs its OSR versions
+        // and the declaration of its llvm function (for naming new ones), so there's nothing
+        // left to free.  Its IR body is already gone.
+        static StatCounter sc_pinned("versions_retired_pinned");
+        sc_pinned.log();
+        return;
+    }
+
+    // Any OSR compiles that exit from this version can't be entered anymore either:
+    for (auto it = clfunc->osr_versions.begin(); it != clfunc->osr_versions.end();) {
+        if (it->first->cf == cf) {
+            if (it->second)
+                retireVersion(it->second);
+            it = clfunc->osr_versions.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    if (!cf->is_interpreted) {
+        CodeMemory* mem = code_memory[cf];
+        code_memory.erase(cf);
+
+        for (const llvm::sys::MemoryBlock &block : mem->blocks) {
+            void* start = block.base();
+            void* end = (char*)block.base() + block.size();
+            deregisterCompiledPatchpoints(start, end);
+            gc::unregisterPreciseFrameRoots(start, end);
+            g.func_addr_registry.unregisterFunctions(start, end);
+            dropCallsiteCaches(start, end);
+        }
+
+        sc_code_bytes_live.log(-(int)mem->total_size);
+        sc_code_bytes_freed.log(mem->total_size);
+        releaseCodeMemory(mem);
+        cf->code = NULL;
+    }
+
+    llvm::Module* module = cf->func->getParent();
+    // Interpreted functions never got handed to the engine:
+    if (!cf->is_interpreted)
+        g.engine->removeModule(module);
+    delete module;
+    cf->func = NULL;
+
+    static StatCounter sc_reclaimed("versions_reclaimed");
+    sc_reclaimed.log();
+    if (VERBOSITY("irgen") >= 1) printf("Freed version %p of %s\n", cf, clfunc->source->getName().c_str());
+}
+
+void reclaimRetiredVersions() {
+    if (retired_versions.empty())
+        return;
+
+    std::vector<void*> return_addrs;
+    unw_cursor_t cursor;
+    unw_context_t uc;
+    unw_getcontext(&uc);
+    unw_init_local(&cursor, &uc);
+    while (unw_step(&cursor) > 0) {
+        unw_word_t ip;
+        unw_get_reg(&cursor, UNW_REG_IP, &ip);
+        return_addrs.push_back((void*)ip);
+    }
+
+    // freeVersion() can retire more versions, which get looked at in this same pass:
+    for (int i = 0; i < retired_versions.size();) {
+        CompiledFunction* cf = retired_versions[i];
+        if (isOnStack(cf, return_addrs)) {
+            i++;
+            continue;
+        }
+
+        retired_versions.erase(retired_versions.begin() + i);
+        freeVersion(cf);
+    }
+}
+
+}
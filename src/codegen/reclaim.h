@@ -0,0 +1,43 @@
+// Copyright (c) 2014 Dropbox, Inc.
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//    http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PYSTON_CODEGEN_RECLAIM_H
+#define PYSTON_CODEGEN_RECLAIM_H
+
+namespace pyston {
+
+class CompiledFunction;
+
+// Freeing the code and IR of function versions that have been superseded.  A retired version
+// can still be running further up the stack, so it only gets freed once the unwinder doesn't
+// find any frames of it.  The CompiledFunction itself stays around, since other versions
+// (and the forwarding in reoptCompiledFunc()) can still have pointers to it.
+
+// Has to be called (with the codegen lock held) right after cf's module got jitted: cf takes
+// ownership of the memory that its code went into, and the IR function body gets freed, since
+// only the interpreter needs it after that.
+void takeJittedCode(CompiledFunction* cf);
+// cf's code address has been embedded in other code, so cf can't ever be freed (other than the
+// IR body that takeJittedCode() already freed).
+void pinCode(CompiledFunction* cf);
+
+// cf isn't in its CLFunction's version lists anymore, so no new calls will get resolved to it.
+void retireVersion(CompiledFunction* cf);
+// Frees the retired versions that aren't on the stack anymore.  Has to be called on the main
+// thread, with the codegen lock held.
+void reclaimRetiredVersions();
+
+}
+
+#endif
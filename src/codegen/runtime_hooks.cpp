@@ -31,6 +31,7 @@
 #include "codegen/irgen.h"
 #include "codegen/irgen/hooks.h"
 #include "codegen/irgen/util.h"
+#include "codegen/type_recording.h"
 
 #include "runtime/int.h"
 #include "runtime/float.h"
@@ -40,6 +41,8 @@
 
 #include "runtime/inline/boxing.h"
 
+#include "gc/collector.h"
+
 namespace pyston {
 
 static llvm::Function* lookupFunction(const std::string &name) {
@@ -127,6 +130,7 @@ void initGlobalFuncs(GlobalState &g) {
     g.funcs.my_assert = getFunc((void*)my_assert, "my_assert");
     g.funcs.malloc = addFunc((void*)malloc, g.i8_ptr, g.i64);
     g.funcs.free = addFunc((void*)free, g.void_, g.i8_ptr);
+    g.funcs.gcWriteBarrier = addFunc((void*)gc::gcWriteBarrier, g.void_, g.i8_ptr);
 
     GET(boxCLFunction);
     GET(unboxCLFunction);
@@ -184,6 +188,8 @@ void initGlobalFuncs(GlobalState &g) {
 
     g.funcs.reoptCompiledFunc = addFunc((void*)reoptCompiledFunc, g.i8_ptr, g.i8_ptr);
     g.funcs.compilePartialFunc = addFunc((void*)compilePartialFunc, g.i8_ptr, g.i8_ptr);
+    g.funcs.recordType = addFunc((void*)recordType, g.void_, g.i8_ptr, g.llvm_value_type_ptr);
+    g.funcs.speculationFailed = addFunc((void*)speculationFailed, g.void_, g.i8_ptr);
 
     g.funcs.div_i64_i64 = getFunc((void*)div_i64_i64, "div_i64_i64");
     g.funcs.mod_i64_i64 = getFunc((void*)mod_i64_i64, "mod_i64_i64");
@@ -18,7 +18,7 @@
 namespace pyston {
 
 struct GlobalFuncs {
-    llvm::Value *printf, *my_assert, *malloc, *free;
+    llvm::Value *printf, *my_assert, *malloc, *free, *gcWriteBarrier;
 
     llvm::Value *boxInt, *unboxInt, *boxFloat, *unboxFloat, *boxStringPtr, *boxCLFunction, *unboxCLFunction, *boxInstanceMethod, *boxBool, *unboxBool, *createTuple, *createDict, *createList, *createSlice, *createClass;
     llvm::Value *getattr, *setattr, *print, *nonzero, *binop, *compare, *augassign, *unboxedLen, *getitem, *getclsattr, *getGlobal, *setitem, *unaryop, *import;
@@ -28,6 +28,7 @@ struct GlobalFuncs {
     llvm::Value *runtimeCall0, *runtimeCall1, *runtimeCall2, *runtimeCall3, *runtimeCall;
     llvm::Value *callattr0, *callattr1, *callattr2, *callattr3, *callattr;
     llvm::Value *reoptCompiledFunc, *compilePartialFunc;
+    llvm::Value *recordType, *speculationFailed;
 
     llvm::Value *div_i64_i64, *mod_i64_i64, *pow_i64_i64;
     llvm::Value *div_float_float, *mod_float_float, *pow_float_float;
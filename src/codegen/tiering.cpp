@@ -0,0 +1,310 @@
+// Copyright (c) 2014 Dropbox, Inc.
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//    http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <sys/time.h>
+#include <unordered_map>
+
+#include "core/common.h"
+#include "core/options.h"
+#include "core/stats.h"
+#include "core/types.h"
+
+#include "core/ast.h"
+#include "core/cfg.h"
+
+#include "codegen/osrentry.h"
+#include "codegen/tiering.h"
+
+namespace pyston {
+namespace tiering {
+
+// The policy's parameters.  The defaults are what used to be hard-coded, so the policy only
+// changes anything if it's asked to with -P.
+// Calls before a version gets reopted, by its effort level:
+static int64_t reopt_interpreted = 10, reopt_minimal = 250, reopt_moderate = 10000;
+// Backedges before an OSR exit, out of interpreted code and out of jitted code:
+static int64_t osr_interpreted = 100, osr_jitted = 10000;
+// Call and backedge counts get halved for every this many ms it took them to reach their
+// threshold, so functions that were only hot briefly (or never very hot) don't get the more
+// expensive compiles.  0 turns this off.
+static int64_t half_life_ms = 0;
+// MINIMAL versions of functions with at most this many basic blocks get reopted straight to
+// MAXIMAL, since compiling them at MAXIMAL is cheap anyway.  0 turns this off.
+static int64_t small_function_blocks = 0;
+// Functions that are expected to take longer than this to reopt need that many times more calls
+// before they get reopted.  The expectation is based on how long compiles at the new effort
+// level have taken so far, per basic block.  0 turns this off.
+static int64_t compile_cost_unit_us = 0;
+// If nonzero, functions whose loops have been hot enough to OSR out of get reopted straight to
+// MAXIMAL:
+static int64_t hot_loop_reopts = 0;
+
+static const struct {
+    const char* name;
+    int64_t* value;
+} settings[] = {
+    {"reopt_interpreted", &reopt_interpreted},
+    {"reopt_minimal", &reopt_minimal},
+    {"reopt_moderate", &reopt_moderate},
+    {"osr_interpreted", &osr_interpreted},
+    {"osr_jitted", &osr_jitted},
+    {"half_life_ms", &half_life_ms},
+    {"small_function_blocks", &small_function_blocks},
+    {"compile_cost_unit_us", &compile_cost_unit_us},
+    {"hot_loop_reopts", &hot_loop_reopts},
+};
+
+// "-P adaptive" turns on all of the above, with these settings:
+static void useAdaptivePolicy() {
+    half_life_ms = 1000;
+    small_function_blocks = 8;
+    compile_cost_unit_us = 10000;
+    hot_loop_reopts = 1;
+}
+
+namespace {
+struct VersionInfo {
+    int64_t reopt_threshold;
+    // When the version got installed, or when its call count last got decayed:
+    timeval counting_since;
+
+    VersionInfo() : reopt_threshold(0) {
+        counting_since.tv_sec = counting_since.tv_usec = 0;
+    }
+};
+}
+static std::unordered_map<CompiledFunction*, VersionInfo> version_info;
+
+// The time spent on compiles, and how many basic blocks they were for, by effort level:
+static long compile_us[EffortLevel::MAXIMAL + 1];
+static long compiled_blocks[EffortLevel::MAXIMAL + 1];
+
+static FILE* decision_log = NULL;
+
+namespace {
+// Why the policy decided what it did, with a counter of how often it did:
+struct Reason {
+    const char *event, *name;
+    StatCounter counter;
+
+    Reason(const char* event, const char* name) : event(event), name(name), counter(std::string("tiering_") + event + "_" + name) {}
+};
+}
+static Reason reopt_interpreted_reason("reopt", "interpreted"), reopt_decayed_reason("reopt", "decayed"),
+       reopt_hot_loops_reason("reopt", "hot_loops"), reopt_small_reason("reopt", "small"), reopt_next_reason("reopt", "next");
+static Reason osr_interpreted_reason("osr", "interpreted"), osr_slow_loop_reason("osr", "slow_loop"),
+       osr_hot_loop_reason("osr", "hot_loop");
+
+void initTieringPolicy() {
+    if (TIERING_POLICY) {
+        std::string spec(TIERING_POLICY);
+        size_t start = 0;
+        while (start < spec.size()) {
+            size_t end = spec.find(',', start);
+            if (end == std::string::npos)
+                end = spec.size();
+            std::string item = spec.substr(start, end - start);
+            start = end + 1;
+
+            if (item == "adaptive") {
+                useAdaptivePolicy();
+                continue;
+            }
+
+            size_t eq = item.find('=');
+            bool found = false;
+            for (int i = 0; i < sizeof(settings) / sizeof(settings[0]) && eq != std::string::npos; i++) {
+                if (item.compare(0, eq, settings[i].name) != 0 || strlen(settings[i].name) != eq)
+                    continue;
+
+                char* num_end;
+                long long value = strtoll(item.c_str() + eq + 1, &num_end, 10);
+                if (*num_end != '\0' || num_end == item.c_str() + eq + 1 || value < 0)
+                    break;
+                *settings[i].value = value;
+                found = true;
+            }
+
+            if (!found) {
+                fprintf(stderr, "Error: bad tiering policy setting '%s'; -P takes a comma-separated list of 'adaptive' and name=value, with these names:\n", item.c_str());
+                for (int i = 0; i < sizeof(settings) / sizeof(settings[0]); i++) {
+                    fprintf(stderr, "  %s (currently %ld)\n", settings[i].name, *settings[i].value);
+                }
+                exit(1);
+            }
+        }
+    }
+
+    if (TIERING_LOG) {
+        decision_log = fopen(TIERING_LOG, "w");
+        RELEASE_ASSERT(decision_log, "couldn't open %s", TIERING_LOG);
+    }
+}
+
+static long usSince(const timeval &since, const timeval &now) {
+    return 1000000L * (now.tv_sec - since.tv_sec) + (now.tv_usec - since.tv_usec);
+}
+
+static int64_t decay(int64_t count, const timeval &since, const timeval &now) {
+    if (half_life_ms == 0 || since.tv_sec == 0)
+        return count;
+
+    long halvings = usSince(since, now) / (half_life_ms * 1000);
+    if (halvings >= 63)
+        return 0;
+    return count >> halvings;
+}
+
+static void logDecision(CompiledFunction* cf, EffortLevel::EffortLevel new_effort, Reason &reason, int64_t count, long us_counting) {
+    reason.counter.log();
+
+    SourceInfo* source = cf->clfunc->source;
+    if (VERBOSITY("irgen") >= 1) {
+        printf("Tiering: %s of %s from effort %d to %d (%s; count %ld over %ldms)\n", reason.event, source->getName().c_str(),
+                cf->effort, new_effort, reason.name, count, us_counting / 1000);
+    }
+
+    if (decision_log) {
+        fprintf(decision_log, "{\"event\": \"%s\", \"function\": \"%s\", \"from\": %d, \"to\": %d, \"reason\": \"%s\", "
+                "\"count\": %ld, \"us_counting\": %ld, \"blocks\": %ld}\n",
+                reason.event, source->getName().c_str(), cf->effort, new_effort, reason.name, count, us_counting,
+                source->cfg->blocks.size());
+        fflush(decision_log);
+    }
+}
+
+int64_t reoptThreshold(CompiledFunction* cf, SourceInfo* source) {
+    assert(cf->effort < EffortLevel::MAXIMAL);
+
+    int64_t threshold;
+    switch (cf->effort) {
+        case EffortLevel::INTERPRETED:
+            threshold = reopt_interpreted;
+            break;
+        case EffortLevel::MINIMAL:
+            threshold = reopt_minimal;
+            break;
+        default:
+            threshold = reopt_moderate;
+            break;
+    }
+
+    int next_effort = cf->effort + 1;
+    if (compile_cost_unit_us && compiled_blocks[next_effort]) {
+        long expected_us = compile_us[next_effort] * source->cfg->blocks.size() / compiled_blocks[next_effort];
+        if (expected_us > compile_cost_unit_us)
+            threshold = threshold * expected_us / compile_cost_unit_us;
+    }
+
+    version_info[cf].reopt_threshold = threshold;
+    return threshold;
+}
+
+int64_t osrThreshold(CompiledFunction* cf) {
+    if (cf->effort == EffortLevel::INTERPRETED)
+        return osr_interpreted;
+    return osr_jitted;
+}
+
+void noteCompile(CompiledFunction* cf, long us) {
+    assert(cf->clfunc);
+    compile_us[cf->effort] += us;
+    compiled_blocks[cf->effort] += cf->clfunc->source->cfg->blocks.size();
+
+    gettimeofday(&version_info[cf].counting_since, NULL);
+}
+
+EffortLevel::EffortLevel reoptEffort(CompiledFunction* cf) {
+    assert(cf->clfunc);
+    assert(cf->effort < EffortLevel::MAXIMAL);
+
+    VersionInfo &info = version_info[cf];
+    timeval now;
+    gettimeofday(&now, NULL);
+    long us_counting = info.counting_since.tv_sec ? usSince(info.counting_since, now) : 0;
+
+    // Interpreted versions don't have any code that they could keep running, so they always get
+    // reopted:
+    if (cf->effort == EffortLevel::INTERPRETED) {
+        logDecision(cf, EffortLevel::MINIMAL, reopt_interpreted_reason, cf->times_called, us_counting);
+        return EffortLevel::MINIMAL;
+    }
+
+    int64_t decayed = decay(cf->times_called, info.counting_since, now);
+    if (decayed <= info.reopt_threshold) {
+        logDecision(cf, cf->effort, reopt_decayed_reason, cf->times_called, us_counting);
+        cf->times_called = decayed;
+        info.counting_since = now;
+        return cf->effort;
+    }
+
+    bool has_osr_versions = false;
+    for (auto it : cf->clfunc->osr_versions) {
+        if (it.second)
+            has_osr_versions = true;
+    }
+
+    EffortLevel::EffortLevel new_effort;
+    Reason* reason;
+    if (hot_loop_reopts && has_osr_versions) {
+        // Its loops have been hot enough to OSR out of:
+        new_effort = EffortLevel::MAXIMAL;
+        reason = &reopt_hot_loops_reason;
+    } else if (cf->effort == EffortLevel::MINIMAL && small_function_blocks && cf->clfunc->source->cfg->blocks.size() <= small_function_blocks) {
+        new_effort = EffortLevel::MAXIMAL;
+        reason = &reopt_small_reason;
+    } else {
+        new_effort = EffortLevel::EffortLevel(cf->effort + 1);
+        reason = &reopt_next_reason;
+    }
+
+    logDecision(cf, new_effort, *reason, cf->times_called, us_counting);
+    return new_effort;
+}
+
+EffortLevel::EffortLevel osrEffort(OSRExit* exit) {
+    CompiledFunction* cf = exit->parent_cf;
+    assert(cf->effort < EffortLevel::MAXIMAL);
+
+    VersionInfo &info = version_info[cf];
+    timeval now;
+    gettimeofday(&now, NULL);
+    long us_counting = info.counting_since.tv_sec ? usSince(info.counting_since, now) : 0;
+
+    EffortLevel::EffortLevel new_effort;
+    Reason* reason;
+    if (cf->effort == EffortLevel::INTERPRETED) {
+        new_effort = EffortLevel::MINIMAL;
+        reason = &osr_interpreted_reason;
+    } else if (decay(exit->backedges, info.counting_since, now) <= osrThreshold(cf)) {
+        // The loop took a while to get here (probably over several calls), so it's not worth
+        // the MAXIMAL compile:
+        new_effort = EffortLevel::EffortLevel(cf->effort + 1);
+        reason = &osr_slow_loop_reason;
+    } else {
+        new_effort = EffortLevel::MAXIMAL;
+        reason = &osr_hot_loop_reason;
+    }
+
+    logDecision(cf, new_effort, *reason, exit->backedges, us_counting);
+    return new_effort;
+}
+
+}
+}
@@ -0,0 +1,56 @@
+// Copyright (c) 2014 Dropbox, Inc.
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//    http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PYSTON_CODEGEN_TIERING_H
+#define PYSTON_CODEGEN_TIERING_H
+
+#include <cstdint>
+
+#include "core/types.h"
+
+namespace pyston {
+
+class OSRExit;
+
+// The tiering policy: when a function version gets reoptimized or OSR'd out of, and what
+// effort level the new version gets compiled at.  Its parameters can be changed with -P, and
+// its decisions get logged to the file given by -L.
+namespace tiering {
+
+// Parses TIERING_POLICY and opens TIERING_LOG.
+void initTieringPolicy();
+
+// The number of calls that cf (which is in the middle of being irgen'd) gets before its code calls
+// reoptCompiledFunc().  With compile_cost_unit_us set, this goes up with how long the function is
+// expected to take to compile.
+int64_t reoptThreshold(CompiledFunction* cf, SourceInfo* source);
+// The number of times one of cf's loop backedges gets taken before it does an OSR exit.
+int64_t osrThreshold(CompiledFunction* cf);
+
+// Has to be called when a version gets installed, with how long it took to compile; that's
+// when its call and backedge counts start.
+void noteCompile(CompiledFunction* cf, long us);
+
+// The effort level to reopt cf to, now that it's gotten past its reopt threshold.  Returns
+// cf->effort if it's not worth reopting after all, since its calls were spread out over too
+// long (which can only happen with half_life_ms set); in that case its call count gets decayed.
+EffortLevel::EffortLevel reoptEffort(CompiledFunction* cf);
+// The effort level of the OSR compile for this exit.
+EffortLevel::EffortLevel osrEffort(OSRExit* exit);
+
+}
+
+}
+
+#endif
@@ -0,0 +1,69 @@
+// Copyright (c) 2014 Dropbox, Inc.
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//    http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <unordered_map>
+
+#include "core/common.h"
+#include "core/stats.h"
+#include "core/types.h"
+
+#include "codegen/type_recording.h"
+
+namespace pyston {
+
+// The number of times in a row that a node has to have produced the same class before it gets
+// speculated on.  Functions get to MODERATE after 250 calls, so this is still reachable for
+// expressions that don't run on every call.
+#define SPECULATION_THRESHOLD 100
+
+static std::unordered_map<AST*, TypeRecorder*> type_recorders;
+
+void TypeRecorder::record(BoxedClass* cls) {
+    if (cls == last_seen) {
+        last_count++;
+    } else {
+        last_seen = cls;
+        last_count = 1;
+    }
+}
+
+BoxedClass* TypeRecorder::predict() {
+    if (last_count < SPECULATION_THRESHOLD)
+        return NULL;
+    return last_seen;
+}
+
+extern "C" void recordType(TypeRecorder* recorder, Box* obj) {
+    // ->cls also works on tagged ints:
+    recorder->record(obj->cls);
+}
+
+TypeRecorder* getTypeRecorderForNode(AST* node) {
+    TypeRecorder* &r = type_recorders[node];
+    if (r == NULL) {
+        static StatCounter sc("type_recorders");
+        sc.log();
+        r = new TypeRecorder();
+    }
+    return r;
+}
+
+BoxedClass* predictClassFor(AST* node) {
+    std::unordered_map<AST*, TypeRecorder*>::iterator it = type_recorders.find(node);
+    if (it == type_recorders.end())
+        return NULL;
+    return it->second->predict();
+}
+
+}
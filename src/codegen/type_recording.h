@@ -0,0 +1,52 @@
+// Copyright (c) 2014 Dropbox, Inc.
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//    http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PYSTON_CODEGEN_TYPERECORDING_H
+#define PYSTON_CODEGEN_TYPERECORDING_H
+
+#include <cstdint>
+
+namespace pyston {
+
+class AST;
+class Box;
+class BoxedClass;
+
+// Type feedback: the INTERPRETED and MINIMAL tiers record the classes of the values that some
+// expressions evaluate to, and the type analysis of the higher tiers speculates (with guards)
+// that they'll keep being those classes.
+class TypeRecorder {
+    private:
+        BoxedClass* last_seen;
+        // How many times in a row last_seen has been seen:
+        int64_t last_count;
+
+    public:
+        TypeRecorder() : last_seen(NULL), last_count(0) {}
+
+        void record(BoxedClass* cls);
+        // The class to speculate on, or NULL if there isn't a consistent enough one:
+        BoxedClass* predict();
+};
+
+extern "C" void recordType(TypeRecorder* recorder, Box* obj);
+
+// The recorder for values of this node, which gets created if there isn't one yet:
+TypeRecorder* getTypeRecorderForNode(AST* node);
+// The class that the profile predicts this node evaluates to, or NULL:
+BoxedClass* predictClassFor(AST* node);
+
+}
+
+#endif
@@ -12,6 +12,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <cstddef>
+
 #include "core/options.h"
 
 namespace pyston {
@@ -24,6 +26,28 @@ int PYTHON_VERSION_MICRO = DEFAULT_PYTHON_MICRO_VERSION;
 
 int MAX_OPT_ITERATIONS = 1;
 
+int GC_MARK_THREADS = 1;
+int GC_GROWTH_PERCENT = 100;
+int GC_SOFT_LIMIT_MB = 0;
+int GC_EMPTY_BLOCKS_MB = 4;
+bool GC_HUGE_PAGES = false;
+const char* GC_EVENT_LOG = NULL;
+
+const char* HEAP_PROFILE_FILE = NULL;
+int HEAP_PROFILE_RATE = 512 * 1024;
+
+int SMALL_INT_CACHE_MIN = -5;
+int SMALL_INT_CACHE_MAX = 1024;
+
+bool TAGGED_INTS = false;
+
+bool BACKGROUND_COMPILE = false;
+
+const char* TIERING_POLICY = NULL;
+const char* TIERING_LOG = NULL;
+
+const char* OBJECT_CACHE_DIR = NULL;
+
 bool FORCE_OPTIMIZE = false;
 bool SHOW_DISASM = false;
 bool BENCH = false;
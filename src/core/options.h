@@ -26,6 +26,33 @@ extern int PYTHON_VERSION_MAJOR, PYTHON_VERSION_MINOR, PYTHON_VERSION_MICRO;
 
 extern int MAX_OPT_ITERATIONS;
 
+extern int GC_MARK_THREADS, GC_GROWTH_PERCENT, GC_SOFT_LIMIT_MB, GC_EMPTY_BLOCKS_MB;
+
+extern bool GC_HUGE_PAGES;
+// If set, a line gets written to this file for every collection:
+extern const char* GC_EVENT_LOG;
+
+// If set, the sampling heap profile gets written to this file on exit:
+extern const char* HEAP_PROFILE_FILE;
+extern int HEAP_PROFILE_RATE;
+
+// The range of ints that boxInt has preallocated boxes for:
+extern int SMALL_INT_CACHE_MIN, SMALL_INT_CACHE_MAX;
+
+// Encode small ints in their pointers instead of allocating them (see isTaggedInt):
+extern bool TAGGED_INTS;
+
+// If set, the machine code of jitted functions gets cached in this directory (see object_cache.h):
+extern const char* OBJECT_CACHE_DIR;
+
+// Do reopts on a background thread, instead of stopping to do them (see hooks.cpp):
+extern bool BACKGROUND_COMPILE;
+
+// Overrides for the tiering policy's parameters, as comma-separated name=value (see tiering.cpp):
+extern const char* TIERING_POLICY;
+// If set, the tiering policy's reopt and OSR decisions get written to this file, one JSON object per line:
+extern const char* TIERING_LOG;
+
 extern bool SHOW_DISASM, FORCE_OPTIMIZE, BENCH, PROFILE, DUMPJIT, TRAP, USE_STRIPPED_STDLIB, ENABLE_INTERPRETER;
 
 extern bool ENABLE_ICS, ENABLE_ICGENERICS, ENABLE_ICGETITEMS, ENABLE_ICSETITEMS, ENABLE_ICBINEXPS, ENABLE_ICNONZEROS, ENABLE_ICCALLSITES, ENABLE_ICSETATTRS, ENABLE_ICGETATTRS, ENABLE_ICGETGLOBALS, ENABLE_SPECULATION, ENABLE_OSR, ENABLE_LLVMOPTS, ENABLE_INLINING, ENABLE_REOPT, ENABLE_PYSTON_PASSES;
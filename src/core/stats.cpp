@@ -13,11 +13,16 @@
 // limitations under the License.
 
 #include <algorithm>
+#include <mutex>
 
 #include "core/stats.h"
 
+#include "core/common.h"
+
 namespace pyston {
 
+static const int MAX_STATS = 4096;
+
 std::vector<long>* Stats::counts;
 std::unordered_map<int, std::string>* Stats::names;
 StatCounter::StatCounter(const std::string &name) : id(Stats::getStatId(name)) {
@@ -31,16 +36,44 @@ int Stats::getStatId(const std::string &name) {
     Stats::counts = &counts;
     static std::unordered_map<std::string, int> made;
 
-    if (made.count(name))
-        return made[name];
+    // Counters can get registered from the background compile thread (see hooks.cpp), which
+    // also logs to the compilation counters while the main thread logs to everything else;
+    // that's only safe as long as registering a counter never moves the existing ones.
+    static std::mutex lock;
+    std::lock_guard<std::mutex> guard(lock);
+    if (counts.capacity() == 0)
+        counts.reserve(MAX_STATS);
+
+    auto it = made.find(name);
+    if (it != made.end())
+        return it->second;
+
+    // Some counters get named at runtime (eg the per-attribute ones with -v), so the table can
+    // fill up; once it does, everything new gets counted in its last slot instead.
+    static const std::string overflow_name("stats_overflow");
+    if (counts.size() == MAX_STATS)
+        return made[overflow_name];
+    const std::string &new_name = (counts.size() == MAX_STATS - 1) ? overflow_name : name;
 
     int rtn = names.size();
-    names[rtn] = name;
-    made[name] = rtn;
+    names[rtn] = new_name;
+    made[new_name] = rtn;
     counts.push_back(0);
     return rtn;
 }
 
+// Sized for every counter there can ever be, since new ones can get registered while it's in use:
+ThreadStats::ThreadStats() : counts(MAX_STATS, 0) {
+}
+
+void ThreadStats::addToGlobal() {
+    int n = Stats::counts->size();
+    for (int i = 0; i < n; i++) {
+        (*Stats::counts)[i] += counts[i];
+        counts[i] = 0;
+    }
+}
+
 void Stats::dump() {
     printf("Stats:\n");
 
@@ -29,6 +29,8 @@ struct Stats {
         static std::vector<long> *counts;
         static std::unordered_map<int, std::string> *names;
 
+        friend class ThreadStats;
+
     public:
         static int getStatId(const std::string &name);
 
@@ -42,6 +44,8 @@ struct Stats {
 struct StatCounter {
     private:
         int id;
+
+        friend class ThreadStats;
     public:
         StatCounter(const std::string &name);
 
@@ -50,6 +54,24 @@ struct StatCounter {
         }
 };
 
+// Private counts for a thread that runs alongside others which log to the same counters (like
+// the parallel GC markers, which all run the same GC handlers); the code that runs on it has to
+// log here explicitly.  addToGlobal() adds them to the real counts, and has to be called once the
+// thread is done, from a thread that's allowed to log to them.
+class ThreadStats {
+    private:
+        std::vector<long> counts;
+
+    public:
+        ThreadStats();
+
+        void log(const StatCounter &counter, int count=1) {
+            counts[counter.id] += count;
+        }
+
+        void addToGlobal();
+};
+
 }
 
 #endif
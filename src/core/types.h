@@ -32,6 +32,17 @@ namespace pyston {
 
 class GCVisitor {
     public:
+        // GC handlers can run on several threads at once (see ParallelMarker), so they log their
+        // stats through logStat(), which uses these counts if they're set:
+        ThreadStats *stats = NULL;
+
+        void logStat(StatCounter &counter, int count=1) {
+            if (stats)
+                stats->log(counter, count);
+            else
+                counter.log(count);
+        }
+
         virtual void visit(void* p) = 0;
         virtual void visitRange(void** start, void** end) = 0;
         virtual void visitPotential(void* p) = 0;
@@ -40,7 +51,7 @@ class GCVisitor {
 
 typedef int kindid_t;
 class AllocationKind;
-extern "C" kindid_t registerKind(const AllocationKind*);
+extern "C" kindid_t registerKind(const AllocationKind*, bool is_flavor);
 class AllocationKind {
     public:
 #ifndef NDEBUG
@@ -56,9 +67,14 @@ class AllocationKind {
 
         const kindid_t kind_id;
 
+    protected:
+        AllocationKind(GCHandler gc_handler, FinalizationFunc finalizer, bool is_flavor) __attribute__((visibility("default"))) :
+                gc_handler(gc_handler), finalizer(finalizer), kind_id(registerKind(this, is_flavor)) {
+        }
+
     public:
         AllocationKind(GCHandler gc_handler, FinalizationFunc finalizer) __attribute__((visibility("default"))) :
-                gc_handler(gc_handler), finalizer(finalizer), kind_id(registerKind(this)) {
+                AllocationKind(gc_handler, finalizer, false) {
         }
 };
 extern "C" const AllocationKind untracked_kind, conservative_kind;
@@ -72,7 +88,7 @@ class ObjectFlavor : public AllocationKind {
         }
 
         ObjectFlavor(GCHandler gc_handler, FinalizationFunc finalizer) __attribute__((visibility("default"))) :
-                AllocationKind(gc_handler, finalizer) {
+                AllocationKind(gc_handler, finalizer, true) {
         }
 };
 
@@ -221,6 +237,10 @@ void addRTFunction(CLFunction *cf, void* f, ConcreteCompilerType* rtn_type, cons
 CLFunction* unboxRTFunction(Box*);
 //extern "C" CLFunction* boxRTFunctionVariadic(const char* name, int nargs_min, int nargs_max, void* f);
 extern "C" CompiledFunction* resolveCLFunc(CLFunction *f, int64_t nargs, Box* arg1, Box* arg2, Box* arg3, Box** args);
+// resolveCLFunc(), with a small cache for the given call site (the return address of the call into the runtime):
+CompiledFunction* resolveCLFuncForCallsite(void* callsite, CLFunction *f, int64_t nargs, Box* arg1, Box* arg2, Box* arg3, Box** args);
+// Forgets the caches of the call sites in (start, end], for when the code there gets freed:
+void dropCallsiteCaches(void* start, void* end);
 extern "C" Box* callCompiledFunc(CompiledFunction *cf, int64_t nargs, Box* arg1, Box* arg2, Box* arg3, Box** args);
 
 std::string getOpName(int op_type);
@@ -298,6 +318,30 @@ class Box : public GCObject {
 
 };
 
+// With -I, small ints don't get allocated; instead they're encoded in the pointer itself, as an
+// address in a range that gets reserved for them (8 bytes per value).  Every word of that range
+// reads as int_cls, so ->cls works on tagged ints (including from jitted code and ICs), but
+// nothing else does: their values have to be read with intValue() rather than BoxedInt::n.
+#define TAGGED_INT_BITS 24
+#define MIN_TAGGED_INT (-(1L << TAGGED_INT_BITS))
+#define MAX_TAGGED_INT ((1L << TAGGED_INT_BITS) - 1)
+// Right after the gc arenas:
+#define TAGGED_INT_ZERO 0x3280000000L
+#define TAGGED_INT_START (TAGGED_INT_ZERO + 8 * MIN_TAGGED_INT)
+#define TAGGED_INT_SIZE (8L << (TAGGED_INT_BITS + 1))
+
+inline bool isTaggedInt(const void* p) {
+    return (uintptr_t)p - TAGGED_INT_START < TAGGED_INT_SIZE;
+}
+
+inline Box* tagInt(int64_t n) {
+    return (Box*)(TAGGED_INT_ZERO + 8 * n);
+}
+
+inline int64_t untagInt(const Box* b) {
+    return ((intptr_t)b - TAGGED_INT_ZERO) >> 3;
+}
+
 
 class SetattrRewriteArgs;
 class SetattrRewriteArgs2;
@@ -25,7 +25,7 @@
 
 namespace pyston {
 
-int Timer::level = 0;
+__thread int Timer::level = 0;
 Timer::Timer(const char* desc, int min_usec) : min_usec(min_usec), ended(true) {
     restart(desc);
 }
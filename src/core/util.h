@@ -24,7 +24,8 @@ namespace pyston {
 
 class Timer {
     private:
-        static int level;
+        // Per-thread, since timers also get used on the background compile thread:
+        static __thread int level;
         timeval start_time;
         const char* desc;
         int min_usec;
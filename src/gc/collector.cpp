@@ -12,21 +12,33 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <atomic>
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <sys/time.h>
 
 #define UNW_LOCAL_ONLY
 #include <libunwind.h>
 
 #include "core/common.h"
+#include "core/options.h"
+#include "core/stats.h"
 #include "core/types.h"
+#include "core/util.h"
 
 #include "codegen/codegen.h"
 
 #include "gc/collector.h"
 #include "gc/heap.h"
 #include "gc/root_finder.h"
+#include "gc/telemetry.h"
 
 namespace pyston {
 namespace gc {
@@ -45,6 +57,9 @@ bool TraceStackGCVisitor::isValid(void* p) {
 }
 
 inline void TraceStackGCVisitor::_visit(void* p) {
+    // Tagged ints look like object pointers, but aren't in the heap:
+    if (isTaggedInt(p))
+        return;
     assert(isValid(p));
     stack->push(p);
 }
@@ -78,23 +93,312 @@ void TraceStackGCVisitor::visitPotentialRange(void** start, void** end) {
 #define KIND_OFFSET 0x111
 static kindid_t num_kinds = 0;
 static AllocationKind::GCHandler handlers[MAX_KINDS];
+static const AllocationKind* kinds[MAX_KINDS];
+static bool kind_is_flavor[MAX_KINDS];
 
-extern "C" kindid_t registerKind(const AllocationKind *kind) {
+extern "C" kindid_t registerKind(const AllocationKind *kind, bool is_flavor) {
     assert(kind == &untracked_kind || kind->gc_handler);
     assert(num_kinds < MAX_KINDS);
     assert(handlers[num_kinds] == NULL);
     handlers[num_kinds] = kind->gc_handler;
+    kinds[num_kinds] = kind;
+    kind_is_flavor[num_kinds] = is_flavor;
     return KIND_OFFSET + num_kinds++;
 }
 
-static void markPhase() {
-    TraceStack stack(roots);
-    collectStackRoots(&stack);
+const AllocationKind* getKind(kindid_t kind_id) {
+    if (kind_id < KIND_OFFSET || kind_id >= KIND_OFFSET + num_kinds)
+        return NULL;
+    return kinds[kind_id - KIND_OFFSET];
+}
+
+bool isFlavorKind(kindid_t kind_id) {
+    assert(getKind(kind_id));
+    return kind_is_flavor[kind_id - KIND_OFFSET];
+}
+
+static std::vector<void (*)()> post_mark_hooks;
+void registerPostMarkHook(void (*hook)()) {
+    post_mark_hooks.push_back(hook);
+}
+
+static void runPostMarkHooks() {
+    for (auto hook : post_mark_hooks) {
+        hook();
+    }
+}
+
+// The number and size of the objects of each kind that got marked, for the telemetry.
+struct KindCounts {
+    long counts[MAX_KINDS];
+    long bytes[MAX_KINDS];
+
+    KindCounts() {
+        memset(counts, 0, sizeof(counts));
+        memset(bytes, 0, sizeof(bytes));
+    }
+
+    void add(void* p, long size) {
+        int idx = headerFromObject(p)->kind_id - KIND_OFFSET;
+        counts[idx]++;
+        bytes[idx] += size;
+    }
+
+    void addAll(const KindCounts &other) {
+        for (int i = 0; i < num_kinds; i++) {
+            counts[i] += other.counts[i];
+            bytes[i] += other.bytes[i];
+        }
+    }
+};
+
+// Old objects that have been written to since the last collection.  They could
+// contain the only references to young objects, so minor collections treat them
+// as roots.
+static std::vector<void*> remembered_set;
+
+void rememberObject(void* holder) {
+    GCObjectHeader* header = headerFromObject(holder);
+    assert(isMarked(header));
+    assert(!isRemembered(header));
+
+    setRemembered(header);
+    remembered_set.push_back(holder);
+}
+
+extern "C" void gcWriteBarrier(void* holder) {
+    writeBarrier(holder);
+}
+
+static void visitByGCKind(void* p, GCVisitor &visitor) {
+    GCObjectHeader* header = headerFromObject(p);
+
+    ASSERT(KIND_OFFSET <= header->kind_id && header->kind_id < KIND_OFFSET + num_kinds, "%p %d", header, header->kind_id);
+
+    if (header->kind_id == untracked_kind.kind_id)
+        return;
+
+    //ASSERT(kind->_cookie == AllocationKind::COOKIE, "%lx %lx", kind->_cookie, AllocationKind::COOKIE);
+    //AllocationKind::GCHandler gcf = kind->gc_handler;
+    AllocationKind::GCHandler gcf = handlers[header->kind_id - KIND_OFFSET];
+
+    assert(gcf);
+    //if (!gcf) {
+        //std::string name = g.func_addr_registry.getFuncNameAtAddress((void*)kind, true);
+        //ASSERT(gcf, "%p %s", kind, name.c_str());
+    //}
+
+    gcf(&visitor, p);
+}
+
+// Scan the remembered objects (without marking them, since they're already old), and
+// remove them from the remembered set.
+static void scanRememberedSet(GCVisitor &visitor) {
+    static StatCounter sc_remembered("gc_remembered_objects");
+
+    for (void* p : remembered_set) {
+        // The object might have been explicitly freed (or realloc'd) since it got
+        // added, in which case the slot is either free or holds a new, unremembered object.
+        if (global_heap.getAllocationFromInteriorPointer(p) != p)
+            continue;
+
+        GCObjectHeader* header = headerFromObject(p);
+        if (!isRemembered(header))
+            continue;
+
+        sc_remembered.log();
+        clearRemembered(header);
+        visitByGCKind(p, visitor);
+    }
+    remembered_set.clear();
+}
+
+// Empty out the remembered set without scanning it, for major collections.
+static void clearRememberedSet() {
+    for (void* p : remembered_set) {
+        if (global_heap.getAllocationFromInteriorPointer(p) != p)
+            continue;
+        clearRemembered(headerFromObject(p));
+    }
+    remembered_set.clear();
+}
+
+// Once a worker's private stack has more than this many entries, it moves half of them
+// to its shared queue (if that's empty) so that idle workers can steal them.
+#define MARK_SHARE_THRESHOLD 64
+
+namespace {
+struct MarkWorker {
+    // Only accessed by the owning thread:
+    TraceStack stack;
+    long marked = 0, marked_bytes = 0, steals = 0;
+    KindCounts kind_counts;
+    // What the GC handlers log on this worker's thread (see GCVisitor::logStat):
+    ThreadStats stats;
+
+    // Work that other threads are allowed to take.  The owner takes from the back,
+    // thieves take from the front.
+    std::mutex shared_lock;
+    std::deque<void*> shared;
+    std::atomic<int> num_shared;
+
+    MarkWorker() : num_shared(0) {}
+};
+}
+
+// Marks the heap using multiple threads, each of which drains its own trace stack and
+// steals from the others when it runs out of work.  Marking is done with tryMark,
+// since multiple threads can reach the same object.
+class ParallelMarker {
+    private:
+        const int nthreads;
+        std::vector<MarkWorker> workers;
+        std::atomic<int> num_idle;
+
+        void share(MarkWorker &w) {
+            std::lock_guard<std::mutex> lock(w.shared_lock);
+            int n = w.stack.size() / 2;
+            for (int i = 0; i < n; i++) {
+                w.shared.push_back(w.stack.pop());
+            }
+            w.num_shared = w.shared.size();
+        }
+
+        // Moves shared work from victim onto w's private stack: all of it if victim is w,
+        // otherwise half.
+        bool takeFrom(MarkWorker &w, MarkWorker &victim) {
+            if (victim.num_shared.load() == 0)
+                return false;
+
+            std::lock_guard<std::mutex> lock(victim.shared_lock);
+            int n = victim.shared.size();
+            if (n == 0)
+                return false;
+
+            if (&w == &victim) {
+                for (int i = 0; i < n; i++) {
+                    w.stack.push(victim.shared.back());
+                    victim.shared.pop_back();
+                }
+            } else {
+                for (int i = 0; i < (n + 1) / 2; i++) {
+                    w.stack.push(victim.shared.front());
+                    victim.shared.pop_front();
+                }
+            }
+            victim.num_shared = victim.shared.size();
+            return true;
+        }
+
+        bool anyShared() {
+            for (MarkWorker &w : workers) {
+                if (w.num_shared.load())
+                    return true;
+            }
+            return false;
+        }
+
+        bool findWork(int id) {
+            MarkWorker &w = workers[id];
+            if (takeFrom(w, w))
+                return true;
+
+            for (int i = 1; i < nthreads; i++) {
+                if (takeFrom(w, workers[(id + i) % nthreads])) {
+                    w.steals++;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void run(int id) {
+            MarkWorker &w = workers[id];
+            TraceStackGCVisitor visitor(&w.stack);
+            visitor.stats = &w.stats;
+            PrefetchQueue queue;
+
+            while (true) {
+                while (void* p = queue.next(w.stack)) {
+                    assert(((intptr_t)p) % 8 == 0);
+                    if (!tryMark(headerFromObject(p)))
+                        continue;
+
+                    long size = global_heap.getAllocationSize(p);
+                    w.marked++;
+                    w.marked_bytes += size;
+                    w.kind_counts.add(p, size);
+                    visitByGCKind(p, visitor);
+
+                    if (w.stack.size() > MARK_SHARE_THRESHOLD && w.num_shared.load() == 0)
+                        share(w);
+                }
+
+                if (findWork(id))
+                    continue;
+
+                // Out of work.  A worker only adds to its own shared queue, and empties it before
+                // getting here, so once every worker is idle there's nothing left to mark.
+                num_idle++;
+                while (true) {
+                    if (num_idle.load() == nthreads)
+                        return;
+
+                    if (anyShared()) {
+                        num_idle--;
+                        if (findWork(id))
+                            break;
+                        num_idle++;
+                    }
+
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+    public:
+        ParallelMarker(int nthreads) : nthreads(nthreads), workers(nthreads), num_idle(0) {
+        }
 
+        // Returns the number of bytes that got marked, and adds the per-kind totals to kind_counts.
+        long mark(TraceStack &roots, KindCounts &kind_counts) {
+            int i = 0;
+            while (void* p = roots.pop()) {
+                workers[i].stack.push(p);
+                i = (i + 1) % nthreads;
+            }
+
+            std::vector<std::thread> threads;
+            for (int i = 1; i < nthreads; i++) {
+                threads.emplace_back(&ParallelMarker::run, this, i);
+            }
+            run(0);
+            for (std::thread &t : threads) {
+                t.join();
+            }
+
+            long marked_bytes = 0;
+            for (int i = 0; i < nthreads; i++) {
+                std::string prefix = "gc_mark_worker" + std::to_string(i);
+                Stats::log(Stats::getStatId(prefix + "_marked"), workers[i].marked);
+                Stats::log(Stats::getStatId(prefix + "_steals"), workers[i].steals);
+                marked_bytes += workers[i].marked_bytes;
+                kind_counts.addAll(workers[i].kind_counts);
+                workers[i].stats.addToGlobal();
+            }
+            return marked_bytes;
+        }
+};
+
+// Marks everything reachable from the stack, on this thread.  Returns the number of bytes that
+// got marked, and adds the per-kind totals to kind_counts if it's not NULL.
+static long markFromStack(TraceStack &stack, KindCounts* kind_counts) {
     TraceStackGCVisitor visitor(&stack);
+    long marked_bytes = 0;
+    PrefetchQueue queue;
 
     //if (VERBOSITY()) printf("Found %d roots\n", stack.size());
-    while (void* p = stack.pop()) {
+    while (void* p = queue.next(stack)) {
         assert(((intptr_t)p) % 8 == 0);
         GCObjectHeader* header = headerFromObject(p);
         //printf("%p\n", p);
@@ -107,44 +411,276 @@ static void markPhase() {
         //printf("Marking + scanning %p\n", p);
 
         setMark(header);
+        long size = global_heap.getAllocationSize(p);
+        marked_bytes += size;
+        if (kind_counts)
+            kind_counts->add(p, size);
+
+        visitByGCKind(p, visitor);
+    }
 
-        ASSERT(KIND_OFFSET <= header->kind_id && header->kind_id < KIND_OFFSET + num_kinds, "%p %d", header, header->kind_id);
+    return marked_bytes;
+}
 
-        if (header->kind_id == untracked_kind.kind_id)
-            continue;
+// Finalizers get run this many at a time, so that a long queue doesn't turn into a pause of its own.
+#define FINALIZER_BATCH_SIZE 64
 
-        //ASSERT(kind->_cookie == AllocationKind::COOKIE, "%lx %lx", kind->_cookie, AllocationKind::COOKIE);
-        //AllocationKind::GCHandler gcf = kind->gc_handler;
-        AllocationKind::GCHandler gcf = handlers[header->kind_id - KIND_OFFSET];
+// The registered objects that haven't been found dead yet.
+static std::unordered_set<void*> finalizable;
+// Dead objects whose finalizers haven't run yet.  An object stays at the front of the queue
+// while its finalizer is running, so that it's still a root.
+static std::deque<void*> pending_finalizers;
 
-        assert(gcf);
-        //if (!gcf) {
-            //std::string name = g.func_addr_registry.getFuncNameAtAddress((void*)kind, true);
-            //ASSERT(gcf, "%p %s", kind, name.c_str());
-        //}
+void registerFinalizable(void* obj) {
+    assert(global_heap.getAllocationFromInteriorPointer(obj) == obj);
+    assert(getKind(headerFromObject(obj)->kind_id)->finalizer);
+    setFinalizable(headerFromObject(obj));
+    finalizable.insert(obj);
+}
+
+void unregisterFinalizable(void* obj) {
+    assert(isFinalizable(headerFromObject(obj)));
+    clearFinalizable(headerFromObject(obj));
+    finalizable.erase(obj);
+}
+
+static void runFinalizer(void* p) {
+    const AllocationKind* kind = getKind(headerFromObject(p)->kind_id);
+    kind->finalizer(p);
+}
+
+// Objects that are waiting to be finalized have to stay alive, along with everything they point to.
+static void collectFinalizationRoots(TraceStack* stack) {
+    for (void* p : pending_finalizers) {
+        stack->push(p);
+    }
+}
+
+// Called after the mark phase: moves the registered objects that didn't get marked to the
+// finalization queue, and then marks them (and whatever they point to) so that they survive
+// until their finalizers have run.  Returns the number of bytes that got marked.
+static long queueFinalizers(TraceStack &stack, KindCounts* kind_counts) {
+    static StatCounter sc_queued("gc_finalizers_queued");
+    static StatCounter sc_depth("gc_finalization_queue_depth");
+
+    int nqueued = 0;
+    for (auto it = finalizable.begin(); it != finalizable.end();) {
+        void* p = *it;
+        if (isMarked(headerFromObject(p))) {
+            ++it;
+            continue;
+        }
+
+        pending_finalizers.push_back(p);
+        stack.push(p);
+        nqueued++;
+        clearFinalizable(headerFromObject(p));
+        it = finalizable.erase(it);
+    }
+    sc_queued.log(nqueued);
+    sc_depth.log(pending_finalizers.size());
 
-        gcf(&visitor, p);
+    if (nqueued == 0)
+        return 0;
+    return markFromStack(stack, kind_counts);
+}
 
+// Finalizers run arbitrary code, which can't happen during a collection or concurrently with the
+// rest of the runtime, so they only get run from here, on the main thread at allocation time.
+void runPendingFinalizers() {
+    // Finalizers can allocate, and so trigger collections of their own:
+    static bool running = false;
+    if (running || pending_finalizers.empty())
+        return;
+
+    static StatCounter sc_run("gc_finalizers_run");
+    static StatCounter sc_us("us_gc_finalizers");
+
+    running = true;
+    Timer _t("running finalizers", 10000);
+    int n = 0;
+    while (n < FINALIZER_BATCH_SIZE && !pending_finalizers.empty()) {
+        runFinalizer(pending_finalizers.front());
+        pending_finalizers.pop_front();
+        n++;
     }
+    sc_run.log(n);
+    sc_us.log(_t.end());
+    running = false;
 }
 
-static void sweepPhase() {
-    global_heap.freeUnmarked();
+// A minor mark phase stops at old objects, since they are already marked; a major one
+// has to be preceded by a call to Heap::clearMarks().
+// Returns the number of bytes that got marked, ie the size of the live heap after a major
+// collection, or the number of bytes promoted by a minor one.  This includes the objects that
+// are being kept alive for their finalizers.
+// Major collections also report what's live to the telemetry.
+static long markPhase(bool minor) {
+    TraceStack stack(roots);
+    collectStackRoots(&stack);
+    collectFinalizationRoots(&stack);
+
+    if (minor) {
+        TraceStackGCVisitor visitor(&stack);
+        scanRememberedSet(visitor);
+    }
+
+    // Minor collections only trace the young generation, which is bounded by the collection
+    // interval, so it's not worth starting up the other threads for them.
+    std::unique_ptr<KindCounts> kind_counts;
+    if (!minor)
+        kind_counts.reset(new KindCounts());
+
+    long marked_bytes;
+    if (!minor && GC_MARK_THREADS > 1) {
+        ParallelMarker marker(GC_MARK_THREADS);
+        marked_bytes = marker.mark(stack, *kind_counts);
+    } else {
+        marked_bytes = markFromStack(stack, kind_counts.get());
+    }
+
+    // There usually aren't many of these, so they just get marked on this thread:
+    marked_bytes += queueFinalizers(stack, kind_counts.get());
+
+    if (kind_counts)
+        recordLiveKinds(kinds, kind_counts->counts, kind_counts->bytes, num_kinds);
+    return marked_bytes;
 }
 
+// The collection policy: minor collections happen every ALLOCBYTES_PER_COLLECTION bytes of
+// allocation (see _collectIfNeeded), and a major collection happens once the bytes promoted
+// since the last major collection exceed the major budget.  The budget is sized from the live
+// heap after the last major collection (GC_GROWTH_PERCENT of it), but never less than
+// MIN_MAJOR_BUDGET; if there's a soft limit (GC_SOFT_LIMIT_MB), it's cut down to however much
+// room is left below the limit, but never less than MIN_MAJOR_BUDGET_AT_LIMIT so that we don't
+// end up doing nothing but major collections.
+#define MIN_MAJOR_BUDGET 8000000
+#define MIN_MAJOR_BUDGET_AT_LIMIT 2000000
+
 static int ncollections = 0;
+static long promoted_since_major = 0;
+static long major_budget = MIN_MAJOR_BUDGET;
+
+static long computeMajorBudget(long live_bytes) {
+    static StatCounter sc_growth("gc_policy_budget_from_growth");
+    static StatCounter sc_minimum("gc_policy_budget_from_minimum");
+    static StatCounter sc_limited("gc_policy_budget_from_soft_limit");
+
+    long budget = live_bytes / 100 * GC_GROWTH_PERCENT;
+    StatCounter* reason = &sc_growth;
+    if (budget < MIN_MAJOR_BUDGET) {
+        budget = MIN_MAJOR_BUDGET;
+        reason = &sc_minimum;
+    }
+
+    if (GC_SOFT_LIMIT_MB) {
+        long headroom = ((long)GC_SOFT_LIMIT_MB << 20) - live_bytes;
+        if (headroom < budget) {
+            budget = std::max(headroom, (long)MIN_MAJOR_BUDGET_AT_LIMIT);
+            reason = &sc_limited;
+        }
+    }
+
+    reason->log();
+    return budget;
+}
+
 void runCollection() {
     static StatCounter sc("gc_collections");
     sc.log();
 
-    if (VERBOSITY("gc") >= 2) printf("Collection #%d\n", ++ncollections);
+    // This has to happen first, since it gives back the slots that were claimed but not
+    // allocated, and corrects bytesAllocatedSinceCollection for them:
+    global_heap.flushThreadCaches();
+
+    long allocated = bytesAllocatedSinceCollection;
+    bytesAllocatedSinceCollection = 0;
+
+    Timer _t("collection", 10000);
+
+    CollectionEvent event;
+    event.number = ++ncollections;
+    event.allocated_bytes = allocated;
+    event.freed_bytes = 0;
+
+    static timeval first_start = {0, 0};
+    timeval start;
+    gettimeofday(&start, NULL);
+    if (first_start.tv_sec == 0)
+        first_start = start;
+    event.start_us = 1000000L * (start.tv_sec - first_start.tv_sec) + (start.tv_usec - first_start.tv_usec);
+
+    // Sweeping is done lazily, so the previous collection might still have blocks queued up.
+    // They have to be swept before marking, since they still contain dead objects that could
+    // otherwise get resurrected by conservative scanning.
+    Timer _t_phase("finishing sweep", 10000);
+    global_heap.finishSweep();
+    recordBytesFreed(global_heap.takeBytesFreed());
+    long sweep_us = _t_phase.split("marking", 10000);
+
+    bool major = (promoted_since_major >= major_budget);
+    event.major = major;
+
+    if (VERBOSITY("gc") >= 2) printf("Collection #%d (%s)\n", ncollections, major ? "major" : "minor");
 
     //if (ncollections == 754) {
         //raise(SIGTRAP);
     //}
 
-    markPhase();
-    sweepPhase();
+    static StatCounter sc_young_bytes("gc_young_allocated_bytes");
+    sc_young_bytes.log(allocated);
+
+    if (major) {
+        static StatCounter sc_major("gc_major_collections");
+        static StatCounter sc_us_major("us_gc_major");
+        static StatCounter sc_live("gc_major_live_bytes");
+        static StatCounter sc_budget("gc_major_budget_bytes");
+        sc_major.log();
+
+        // Anything that's still alive will get re-marked, and is by definition not pointing
+        // to anything unmarked, so the remembered set isn't needed:
+        clearRememberedSet();
+        global_heap.clearMarks();
+
+        long live_bytes = markPhase(false);
+        runPostMarkHooks();
+        event.mark_us = _t_phase.split("starting sweep", 10000);
+        global_heap.startSweep(false);
+        sweep_us += _t_phase.end();
+        promoted_since_major = 0;
+        major_budget = computeMajorBudget(live_bytes);
+
+        long us = _t.end();
+        sc_us_major.log(us);
+        sc_live.log(live_bytes);
+        sc_budget.log(major_budget);
+        if (VERBOSITY("gc") >= 2) printf("Major collection: %ld live bytes, next major after %ld promoted bytes; took %ldus\n", live_bytes, major_budget, us);
+
+        event.marked_bytes = live_bytes;
+        event.pause_us = us;
+    } else {
+        static StatCounter sc_minor("gc_minor_collections");
+        static StatCounter sc_us_minor("us_gc_minor");
+        static StatCounter sc_promoted("gc_promoted_bytes");
+        sc_minor.log();
+
+        long promoted = markPhase(true);
+        runPostMarkHooks();
+        event.mark_us = _t_phase.split("starting sweep", 10000);
+        global_heap.startSweep(true);
+        sweep_us += _t_phase.end();
+        promoted_since_major += promoted;
+
+        long us = _t.end();
+        sc_us_minor.log(us);
+        sc_promoted.log(promoted);
+
+        event.marked_bytes = promoted;
+        event.pause_us = us;
+    }
+
+    event.sweep_us = sweep_us;
+    recordCollection(event);
 }
 
 } // namespace gc
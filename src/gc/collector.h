@@ -18,29 +18,112 @@
 #include <vector>
 
 #include "core/types.h"
+#include "gc/heap.h"
 
 namespace pyston {
 namespace gc {
 
 #define MARK_BIT 0x1
+#define REMEMBERED_BIT 0x2
+#define FINALIZABLE_BIT 0x4
 
 inline GCObjectHeader* headerFromObject(void* obj) {
     return static_cast<GCObjectHeader*>(obj);
 }
 
+// Small objects keep their mark bits in a side table in their Block, so that marking doesn't
+// have to write to the objects themselves (and dirty their cache lines and pages); large objects
+// keep theirs in gc_flags.
 inline void setMark(GCObjectHeader *header) {
-    header->gc_flags |= MARK_BIT;
+    if (isSmallArenaPointer(header)) {
+        int word;
+        uint64_t mask;
+        Block* b = Block::bitForPointer(header, &word, &mask);
+        b->marks[word] |= mask;
+    } else {
+        header->gc_flags |= MARK_BIT;
+    }
 }
 
 inline void clearMark(GCObjectHeader *header) {
-    header->gc_flags &= ~MARK_BIT;
+    if (isSmallArenaPointer(header)) {
+        int word;
+        uint64_t mask;
+        Block* b = Block::bitForPointer(header, &word, &mask);
+        b->marks[word] &= ~mask;
+    } else {
+        header->gc_flags &= ~MARK_BIT;
+    }
 }
 
 inline bool isMarked(GCObjectHeader *header) {
+    if (isSmallArenaPointer(header)) {
+        int word;
+        uint64_t mask;
+        Block* b = Block::bitForPointer(header, &word, &mask);
+        return (b->marks[word] & mask) != 0;
+    }
     return (header->gc_flags & MARK_BIT) != 0;
 }
 
+// Atomically sets the mark bit, for when multiple threads are marking;
+// returns whether this call was the one that marked the object.
+inline bool tryMark(GCObjectHeader *header) {
+    if (isSmallArenaPointer(header)) {
+        int word;
+        uint64_t mask;
+        Block* b = Block::bitForPointer(header, &word, &mask);
+        return (__sync_fetch_and_or(&b->marks[word], mask) & mask) == 0;
+    }
+    return (__sync_fetch_and_or(&header->gc_flags, MARK_BIT) & MARK_BIT) == 0;
+}
+
+// Gets the object's mark bit into cache, along with the start of the object itself.
+inline void prefetchForMarking(void* p) {
+    if (isSmallArenaPointer(p)) {
+        int word;
+        uint64_t mask;
+        Block* b = Block::bitForPointer(p, &word, &mask);
+        __builtin_prefetch(&b->marks[word], 1);
+    }
+    __builtin_prefetch(p);
+}
+
+// The remembered bit is only ever set on marked (ie old) objects; it means the object
+// is in the remembered set and will get rescanned by the next minor collection.
+inline void setRemembered(GCObjectHeader *header) {
+    header->gc_flags |= REMEMBERED_BIT;
+}
+
+inline void clearRemembered(GCObjectHeader *header) {
+    header->gc_flags &= ~REMEMBERED_BIT;
+}
+
+inline bool isRemembered(GCObjectHeader *header) {
+    return (header->gc_flags & REMEMBERED_BIT) != 0;
+}
+
+// Set while the object is registered as finalizable (see registerFinalizable), so that freeing
+// any other object doesn't have to look it up.
+inline void setFinalizable(GCObjectHeader *header) {
+    header->gc_flags |= FINALIZABLE_BIT;
+}
+
+inline void clearFinalizable(GCObjectHeader *header) {
+    header->gc_flags &= ~FINALIZABLE_BIT;
+}
+
+inline bool isFinalizable(GCObjectHeader *header) {
+    return (header->gc_flags & FINALIZABLE_BIT) != 0;
+}
+
+inline void clearGCFlags(GCObjectHeader *header) {
+    header->gc_flags = 0;
+}
+
 #undef MARK_BIT
+#undef REMEMBERED_BIT
+#undef FINALIZABLE_BIT
 
 class TraceStack {
     private:
@@ -65,6 +148,39 @@ class TraceStack {
         }
 };
 
+// Marking mostly consists of cache misses on the objects being scanned, so instead of
+// scanning each object as soon as it comes off the trace stack, the mark loop runs them
+// through this small FIFO and prefetches them on the way in; by the time an object comes
+// out, its mark bit and header should be in cache.
+#define MARK_PREFETCH_DISTANCE 8
+class PrefetchQueue {
+    private:
+        void* q[MARK_PREFETCH_DISTANCE];
+        int start = 0, count = 0;
+
+    public:
+        // Returns the next object to mark, refilling the queue from the stack;
+        // returns NULL once both are empty.
+        void* next(TraceStack &stack) {
+            while (count < MARK_PREFETCH_DISTANCE) {
+                void* p = stack.pop();
+                if (!p)
+                    break;
+                prefetchForMarking(p);
+                q[(start + count) % MARK_PREFETCH_DISTANCE] = p;
+                count++;
+            }
+
+            if (count == 0)
+                return NULL;
+
+            void* rtn = q[start];
+            start = (start + 1) % MARK_PREFETCH_DISTANCE;
+            count--;
+            return rtn;
+        }
+};
+
 class TraceStackGCVisitor : public GCVisitor {
     private:
         bool isValid(void* p);
@@ -87,6 +203,42 @@ class TraceStackGCVisitor : public GCVisitor {
 void registerStaticRootObj(void* root_obj);
 void runCollection();
 
+// Returns NULL if kind_id isn't the id of a registered kind (eg if it was read out of an
+// object that hasn't been initialized).
+const AllocationKind* getKind(kindid_t kind_id);
+// Whether the kind is an ObjectFlavor, ie whether its objects are Boxes.
+bool isFlavorKind(kindid_t kind_id);
+
+// Hooks get called after every mark phase, before anything gets swept, so they can use
+// isMarked() to find out what survived the collection.
+void registerPostMarkHook(void (*hook)());
+
+// Objects whose kind has a finalizer have to be registered when they get created, or the finalizer
+// won't get called.  Once a collection finds a registered object to be dead, the object (and
+// everything it points to) is kept alive and put on a queue; the finalizers get run in batches
+// after the collection, and the objects get freed by a later one.
+void registerFinalizable(void* obj);
+// For objects that get freed explicitly: they won't get finalized.  Only needs to be called if
+// isFinalizable() is set.
+void unregisterFinalizable(void* obj);
+// Runs some of the finalizers that are waiting to run, if there are any.  This has to be called
+// on the main thread, outside of collections.
+void runPendingFinalizers();
+
+// The collector is generational, but non-moving: objects that survive a collection
+// stay marked, and count as being in the old generation from then on.  Minor collections
+// only trace young objects, so any time a pointer gets stored into an existing gc object,
+// the write barrier has to be run on the object that was written to (the "holder").
+// There can't be any allocations between the store and the barrier.
+void rememberObject(void* holder);
+inline void writeBarrier(void* holder) {
+    GCObjectHeader* header = headerFromObject(holder);
+    if (isMarked(header) && !isRemembered(header))
+        rememberObject(holder);
+}
+// Out-of-line version of writeBarrier, for calling from generated code:
+extern "C" void gcWriteBarrier(void* holder);
+
 }
 }
 
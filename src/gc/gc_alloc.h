@@ -23,7 +23,7 @@
 namespace pyston {
 namespace gc {
 
-inline void* gc_alloc(size_t bytes) __attribute__((visibility("default")));
+inline void* gc_alloc(size_t bytes) __attribute__((visibility("default"))) ALWAYSINLINE;
 inline void* gc_alloc(size_t bytes) {
     //if ((++numAllocs) >= ALLOCS_PER_COLLECTION) {
         //numAllocs = 0;
@@ -53,6 +53,8 @@ inline void* gc_realloc(void* ptr, size_t bytes) {
 
 inline void gc_free(void* ptr) __attribute__((visibility("default")));
 inline void gc_free(void* ptr) {
+    if (isFinalizable(headerFromObject(ptr)))
+        unregisterFinalizable(ptr);
     global_heap.free(ptr);
 }
 
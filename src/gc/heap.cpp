@@ -15,7 +15,10 @@
 #include <cstring>
 #include <cstdlib>
 #include <cstdio>
+#include <algorithm>
 #include <cassert>
+#include <map>
+#include <mutex>
 #include <stdint.h>
 #include <sys/mman.h>
 
@@ -24,6 +27,8 @@
 #include "gc/gc_alloc.h"
 
 #include "core/common.h"
+#include "core/options.h"
+#include "core/stats.h"
 
 namespace pyston {
 namespace gc {
@@ -35,9 +40,12 @@ extern unsigned bytesAllocatedSinceCollection;
 
 void _collectIfNeeded(size_t bytes) {
     if (bytesAllocatedSinceCollection >= ALLOCBYTES_PER_COLLECTION) {
-        bytesAllocatedSinceCollection = 0;
+        // runCollection() resets bytesAllocatedSinceCollection
         runCollection();
     }
+    // This is outside of the collection's pause, and at a point where the allocator is in a
+    // consistent state, so the finalizers are free to allocate:
+    runPendingFinalizers();
     bytesAllocatedSinceCollection += bytes;
 }
 
@@ -45,24 +53,57 @@ void _collectIfNeeded(size_t bytes) {
 Heap global_heap;
 
 #define PAGE_SIZE 4096
+// Each arena reserves ARENA_SIZE of address space up front, without committing any memory to it,
+// and then makes it accessible this much at a time:
+#define ARENA_CHUNK_SIZE (4 << 20)
+static_assert(ARENA_CHUNK_SIZE % (2 << 20) == 0, "chunks should be aligned to huge pages");
+
 class Arena {
     private:
-        void* start;
+        void* const start;
+        // Everything in [start, cur) has been handed out; [cur, committed) is accessible
+        // but hasn't been used yet.
         void* cur;
+        void* committed;
+        const bool huge_pages;
+
+        void reserve() {
+            void* mrtn = mmap(start, ARENA_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            RELEASE_ASSERT(mrtn != MAP_FAILED, "failed to reserve address space");
+            RELEASE_ASSERT(mrtn == start, "%p %p\n", mrtn, start);
+        }
+
+        void commit(size_t size) {
+            static StatCounter sc_chunks("gc_arena_chunks_committed");
+
+            if (committed == start)
+                reserve();
+
+            size_t chunk_size = (size + ARENA_CHUNK_SIZE - 1) & ~(size_t)(ARENA_CHUNK_SIZE - 1);
+            RELEASE_ASSERT((uint8_t*)committed + chunk_size <= (uint8_t*)start + ARENA_SIZE, "ran out of address space in the gc arena");
+
+            int r = mprotect(committed, chunk_size, PROT_READ | PROT_WRITE);
+            RELEASE_ASSERT(r == 0, "failed to allocate memory from OS");
+            if (huge_pages && GC_HUGE_PAGES)
+                madvise(committed, chunk_size, MADV_HUGEPAGE);
+
+            committed = (uint8_t*)committed + chunk_size;
+            sc_chunks.log(chunk_size / ARENA_CHUNK_SIZE);
+        }
 
     public:
-        constexpr Arena(void* start) : start(start), cur(start) {
+        constexpr Arena(void* start, bool huge_pages) : start(start), cur(start), committed(start), huge_pages(huge_pages) {
         }
 
-        void* doMmap(size_t size) {
+        void* allocate(size_t size) {
             assert(size % PAGE_SIZE == 0);
-            //printf("mmap %ld\n", size);
 
-            void* mrtn = mmap(cur, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-            assert((uintptr_t)mrtn != -1 && "failed to allocate memory from OS");
-            ASSERT(mrtn == cur, "%p %p\n", mrtn, cur);
+            if ((uint8_t*)cur + size > (uint8_t*)committed)
+                commit((uint8_t*)cur + size - (uint8_t*)committed);
+
+            void* rtn = cur;
             cur = (uint8_t*)cur + size;
-            return mrtn;
+            return rtn;
         }
 
         bool contains(void* addr) {
@@ -70,21 +111,85 @@ class Arena {
         }
 };
 
-Arena small_arena((void*)0x1270000000L);
-Arena large_arena((void*)0x2270000000L);
+Arena small_arena((void*)SMALL_ARENA_START, true);
+Arena large_arena((void*)LARGE_ARENA_START, false);
+
+// What's on each page of the arenas, so that getAllocationFromInteriorPointer can reject
+// pointers to unused pages without touching them, and can find a block's size class without
+// reading its header.  A page's entry is PAGE_UNUSED, the block's size class + 1 for small
+// blocks, or one of the PAGE_LARGE values for the pages of large objects.
+#define NUM_HEAP_PAGES (2 * ARENA_SIZE / PAGE_SIZE)
+#define PAGE_UNUSED 0
+#define PAGE_LARGE_START 0xff
+#define PAGE_LARGE_REST 0xfe
+static_assert(NUM_BUCKETS < PAGE_LARGE_REST, "");
+// Only gets reserved once something gets allocated, and only the parts of it that get
+// written to take up memory.
+static uint8_t* page_kinds = NULL;
+
+static uint8_t* pageKindFor(void* p) {
+    return &page_kinds[((uintptr_t)p - SMALL_ARENA_START) / PAGE_SIZE];
+}
+
+static void setPageKinds(void* start, size_t size, uint8_t kind) {
+    if (!page_kinds) {
+        void* mrtn = mmap(NULL, NUM_HEAP_PAGES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        RELEASE_ASSERT(mrtn != MAP_FAILED, "failed to reserve the page map");
+        page_kinds = (uint8_t*)mrtn;
+    }
+
+    assert(size % PAGE_SIZE == 0);
+    memset(pageKindFor(start), kind, size / PAGE_SIZE);
+}
+
+// For every page of a large object's mapping, the index of its first page in the large arena, so
+// that an interior pointer into a large object doesn't have to walk back to its start.  Reserved
+// the same way as page_kinds; entries for pages that aren't PAGE_LARGE_* are stale.
+#define NUM_LARGE_PAGES (ARENA_SIZE / PAGE_SIZE)
+static_assert(NUM_LARGE_PAGES <= (1L << 32), "");
+static uint32_t* large_start_pages = NULL;
+
+static void setLargeStartPages(void* start, size_t size) {
+    if (!large_start_pages) {
+        void* mrtn = mmap(NULL, NUM_LARGE_PAGES * sizeof(uint32_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        RELEASE_ASSERT(mrtn != MAP_FAILED, "failed to reserve the large object page map");
+        large_start_pages = (uint32_t*)mrtn;
+    }
+
+    assert(size % PAGE_SIZE == 0);
+    uint32_t start_page = ((uintptr_t)start - LARGE_ARENA_START) / PAGE_SIZE;
+    std::fill(&large_start_pages[start_page], &large_start_pages[start_page + size / PAGE_SIZE], start_page);
+}
+
+// Dividing by the object size is the slowest part of finding an object from an interior
+// pointer, so do it as a multiplication by the reciprocal instead: for any offset within a
+// block, offset / sizes[i] == (offset * size_reciprocals[i]) >> 32.
+#define RECIPROCAL(i) (uint32_t)(((1UL << 32) + sizes[i] - 1) / sizes[i])
+#define RECIPROCAL4(i) RECIPROCAL(i), RECIPROCAL(i + 1), RECIPROCAL(i + 2), RECIPROCAL(i + 3)
+static constexpr uint32_t size_reciprocals[] = {
+    RECIPROCAL4(0), RECIPROCAL4(4), RECIPROCAL4(8), RECIPROCAL4(12), RECIPROCAL4(16), RECIPROCAL4(20),
+};
+#undef RECIPROCAL
+#undef RECIPROCAL4
+static_assert(sizeof(size_reciprocals) / sizeof(size_reciprocals[0]) == NUM_BUCKETS, "");
+
+static inline int divideBySize(uint32_t offset, int bucket_idx) {
+    return ((uint64_t)offset * size_reciprocals[bucket_idx]) >> 32;
+}
 
 struct LargeObj {
     LargeObj *next, **prev;
     size_t obj_size;
+    // The size of the pages this object occupies, which can be more than it needs
+    // if they got recycled from a bigger object:
+    size_t mapping_size;
     char data[0];
 
-    int mmap_size() {
-        size_t total_size = obj_size + sizeof(LargeObj);
-        total_size = (total_size + PAGE_SIZE - 1) & ~(PAGE_SIZE-1);
-        return total_size;
+    size_t mmap_size() {
+        return mapping_size;
     }
 
-    int capacity() {
+    size_t capacity() {
         return mmap_size() - sizeof(LargeObj);
     }
 
@@ -95,13 +200,59 @@ struct LargeObj {
     }
 };
 
+// Pages from freed large objects, for reuse by later large objects.  Only up to
+// LARGE_CACHE_RESIDENT_BYTES of them are kept resident; the rest get handed back to the
+// OS with madvise, but keep their address range so that it can still be reused.
+#define LARGE_CACHE_RESIDENT_BYTES (32 << 20)
+// Don't put an object into pages that are more than this many times bigger than it needs:
+#define LARGE_CACHE_MAX_WASTE 2
+static std::multimap<size_t, void*> free_large_mappings;
+static size_t free_large_resident_bytes = 0;
+
+static void* takeLargeMapping(size_t size, size_t* mapping_size) {
+    static StatCounter sc_reused("gc_large_mappings_reused");
+    static StatCounter sc_new("gc_large_mappings_new");
+
+    auto it = free_large_mappings.lower_bound(size);
+    if (it != free_large_mappings.end() && it->first <= size * LARGE_CACHE_MAX_WASTE) {
+        void* rtn = it->second;
+        *mapping_size = it->first;
+        free_large_mappings.erase(it);
+        // This might count pages that were already released, but that just means we'll
+        // release a bit more eagerly later.
+        free_large_resident_bytes -= std::min(free_large_resident_bytes, *mapping_size);
+        sc_reused.log();
+        return rtn;
+    }
+
+    sc_new.log();
+    *mapping_size = size;
+    return large_arena.allocate(size);
+}
+
+static void releaseLargeMapping(void* p, size_t size) {
+    if (free_large_resident_bytes + size > LARGE_CACHE_RESIDENT_BYTES) {
+        static StatCounter sc_released("gc_large_bytes_released");
+        int r = madvise(p, size, MADV_DONTNEED);
+        assert(r == 0);
+        sc_released.log(size);
+    } else {
+        free_large_resident_bytes += size;
+    }
+    free_large_mappings.insert(std::make_pair(size, p));
+}
+
 void* Heap::allocLarge(size_t size) {
     _collectIfNeeded(size);
 
     size_t total_size = size + sizeof(LargeObj);
     total_size = (total_size + PAGE_SIZE - 1) & ~(PAGE_SIZE-1);
-    LargeObj* rtn = (LargeObj*)large_arena.doMmap(total_size);
+    size_t mapping_size;
+    LargeObj* rtn = (LargeObj*)takeLargeMapping(total_size, &mapping_size);
     rtn->obj_size = size;
+    rtn->mapping_size = mapping_size;
+    // Recycled pages still have the old object's flags:
+    clearGCFlags(headerFromObject(rtn->data));
 
     rtn->next = large_head;
     if (rtn->next)
@@ -109,17 +260,21 @@ void* Heap::allocLarge(size_t size) {
     rtn->prev = &large_head;
     large_head = rtn;
 
+    setPageKinds(rtn, PAGE_SIZE, PAGE_LARGE_START);
+    setPageKinds((char*)rtn + PAGE_SIZE, mapping_size - PAGE_SIZE, PAGE_LARGE_REST);
+    setLargeStartPages(rtn, mapping_size);
+
     return &rtn->data;
 }
 
-static Block* alloc_block(uint64_t size, Block** prev) {
-    // TODO use mmap
-
-    Block* rtn = (Block*)small_arena.doMmap(sizeof(Block));
-    assert(rtn);
+static void initBlock(Block* rtn, uint64_t size) {
     rtn->size = size;
-    rtn->prev = prev;
+    rtn->prev = NULL;
     rtn->next = NULL;
+    rtn->has_young = 0;
+    rtn->needs_sweep = 0;
+    rtn->in_cache = 0;
+    rtn->first_free_word = 0;
 
 #ifdef VALGRIND
     VALGRIND_CREATE_MEMPOOL(rtn, 0, true);
@@ -127,6 +282,7 @@ static Block* alloc_block(uint64_t size, Block** prev) {
 
     // Don't think I need to do this:
     memset(rtn->isfree, 0, sizeof(Block::isfree));
+    memset(rtn->marks, 0, sizeof(Block::marks));
 
     int num_objects = rtn->numObjects();
     int num_lost = rtn->minObjIndex();
@@ -142,87 +298,280 @@ static Block* alloc_block(uint64_t size, Block** prev) {
     //for (int i =0; i < BITFIELD_ELTS; i++) {
         //printf("%d: %lx\n", i, rtn->isfree[i]);
     //}
+}
+
+static void removeFromList(Block* b) {
+    *b->prev = b->next;
+    if (b->next)
+        b->next->prev = b->prev;
+}
+
+static void insertIntoList(Block** head, Block* b) {
+    b->next = *head;
+    if (b->next)
+        b->next->prev = &b->next;
+    b->prev = head;
+    *head = b;
+}
+
+static void noteFreeWord(Block* b, int word) {
+    if (word < b->first_free_word)
+        b->first_free_word = word;
+}
+
+static bool hasFreeSpace(Block* b) {
+    for (int i = b->first_free_word; i < BITFIELD_ELTS; i++) {
+        if (b->isfree[i])
+            return true;
+        b->first_free_word = i + 1;
+    }
+    return false;
+}
+
+static int bucketForSize(size_t size) {
+    int rtn = sizeClassFor(size);
+    assert(sizes[rtn] == size);
+    return rtn;
+}
+
+Block* Heap::allocBlock(uint64_t size) {
+    static StatCounter sc_new("gc_blocks_new");
+    static StatCounter sc_reused("gc_blocks_reused");
+
+    Block* rtn;
+    if (empty_blocks.size()) {
+        rtn = empty_blocks.back();
+        empty_blocks.pop_back();
+        // The old contents could look like a marked object header to the new size class:
+        memset(rtn, 0, sizeof(Block));
+        sc_reused.log();
+    } else if (released_blocks.size()) {
+        // These already read as zeroes, since their pages were given back:
+        rtn = released_blocks.back();
+        released_blocks.pop_back();
+        sc_reused.log();
+    } else {
+        rtn = (Block*)small_arena.allocate(sizeof(Block));
+        sc_new.log();
+    }
+    assert(rtn);
+
+    initBlock(rtn, size);
+    setPageKinds(rtn, BLOCK_SIZE, bucketForSize(size) + 1);
     return rtn;
 }
 
-void* Heap::allocSmall(size_t rounded_size, Block** prev, Block** full_head) {
-    _collectIfNeeded(rounded_size);
+// Once there are this many more empty blocks than we want to keep resident, give the
+// extra ones back to the OS right away rather than waiting for the next collection:
+#define EMPTY_BLOCK_RELEASE_BATCH 64
+
+void Heap::poolEmptyBlock(Block* b) {
+    static StatCounter sc_pooled("gc_blocks_emptied");
+
+    assert(!b->in_cache);
+    assert(!b->needs_sweep);
+    assert(!b->has_young);
+
+    removeFromList(b);
+    b->prev = NULL;
+    b->next = NULL;
+    // getAllocationFromInteriorPointer skips pooled blocks based on the page map, but other
+    // code treats size-0 blocks as not containing anything; released blocks will read as
+    // zeroes too.
+    b->size = 0;
+    setPageKinds(b, BLOCK_SIZE, PAGE_UNUSED);
+#ifdef VALGRIND
+    VALGRIND_DESTROY_MEMPOOL(b);
+#endif
+
+    empty_blocks.push_back(b);
+    sc_pooled.log();
 
-    Block *cur = *prev;
-    assert(!cur || prev == cur->prev);
-    int scanned = 0;
+    if (empty_blocks.size() >= maxResidentEmptyBlocks() + EMPTY_BLOCK_RELEASE_BATCH)
+        releaseEmptyBlocks();
+}
+
+size_t Heap::maxResidentEmptyBlocks() {
+    return ((size_t)GC_EMPTY_BLOCKS_MB << 20) / BLOCK_SIZE;
+}
 
-    //printf("alloc(%ld)\n", rounded_size);
+void Heap::releaseEmptyBlocks() {
+    static StatCounter sc_released("gc_blocks_released");
+
+    size_t max_resident = maxResidentEmptyBlocks();
+    if (empty_blocks.size() <= max_resident)
+        return;
+
+    // Release the blocks that have been sitting in the pool the longest, and keep the ones
+    // that were emptied most recently, since they're the most likely to still be in cache.
+    auto begin = empty_blocks.begin(), end = empty_blocks.begin() + (empty_blocks.size() - max_resident);
+    std::sort(begin, end);
+    // Coalesce adjacent blocks so that this is one syscall per run rather than per block:
+    for (auto run_start = begin; run_start != end; ) {
+        auto run_end = run_start + 1;
+        while (run_end != end && *run_end == *(run_end - 1) + 1)
+            ++run_end;
+
+        int r = madvise(*run_start, (run_end - run_start) * sizeof(Block), MADV_DONTNEED);
+        assert(r == 0);
+        run_start = run_end;
+    }
+
+    sc_released.log(end - begin);
+    released_blocks.insert(released_blocks.end(), begin, end);
+    empty_blocks.erase(begin, end);
+}
+
+// Before growing the heap by a block, sweep this many blocks from other size classes:
+#define SWEEP_BLOCKS_PER_NEW_BLOCK 4
+
+Block* Heap::takeBlockForCache(int bucket_idx, ThreadCache* cache) {
+    static StatCounter sc_refills("gc_thread_cache_refills");
+    sc_refills.log();
+
+    Block *cur = heads[bucket_idx];
 
-    //Block **full_prev = full_head;
     while (true) {
-        //printf("cur = %p, prev = %p\n", cur, prev);
         if (cur == NULL) {
-            Block *next = alloc_block(rounded_size, &cur->next);
-            //printf("allocated new block %p\n", next);
-            *prev = next;
-            next->prev = prev;
-            prev = &cur->next;
+            // Every block in the list was full; see if sweeping one of the blocks that
+            // the last collection left behind frees up some space before getting a new block.
+            cur = sweepPending(bucket_idx, cache);
+            if (cur == NULL) {
+                sweepSomePending();
+
+                cur = allocBlock(sizes[bucket_idx]);
+                insertIntoList(&heads[bucket_idx], cur);
+                //printf("allocated new block %p\n", cur);
+            }
+        }
 
-            next->next = *full_head;
-            *full_head = NULL;
-            prev = full_head;
+        if (cur->needs_sweep) {
+            static StatCounter sc_lazy("gc_blocks_swept_lazily");
+            sc_lazy.log();
+            sweepBlock(cur, cache);
+        }
 
-            cur = next;
+        if (!hasFreeSpace(cur)) {
+            Block *t = cur->next;
+            removeFromList(cur);
+            insertIntoList(&full_heads[bucket_idx], cur);
+            cur = t;
+            continue;
         }
 
-        int i = 0;
-        uint64_t mask = 0;
-        for (; i < BITFIELD_ELTS; i++) {
-            mask = cur->isfree[i];
-            if (mask != 0L) {
-                break;
-            }
+        removeFromList(cur);
+        cur->prev = NULL;
+        cur->next = NULL;
+        cur->in_cache = 1;
+
+        if (!cur->has_young) {
+            cur->has_young = 1;
+            young_blocks.push_back(cur);
         }
 
-        if (i == BITFIELD_ELTS) {
-            scanned++;
-            //printf("moving on\n");
+        return cur;
+    }
+}
+
+void Heap::releaseCachedBlock(Block* b) {
+    assert(b->in_cache);
+    b->in_cache = 0;
 
-            Block *t = *prev = cur->next;
-            cur->next = NULL;
-            if (t) t->prev = prev;
+    int bucket_idx = bucketForSize(b->size);
+    if (hasFreeSpace(b))
+        insertIntoList(&heads[bucket_idx], b);
+    else
+        insertIntoList(&full_heads[bucket_idx], b);
+}
 
-            cur->prev = full_head;
-            cur->next = *full_head;
-            *full_head = cur;
+__thread ThreadCache* Heap::thread_cache = NULL;
 
-            cur = t;
+ThreadCache* Heap::getThreadCache() {
+    ThreadCache* c = thread_cache;
+    if (c)
+        return c;
 
-            scanned++;
-            continue;
-        }
+    // This is the only part of the heap that's currently safe to call from multiple threads;
+    // everything past the thread caches still assumes a single mutator.
+    static std::mutex caches_mutex;
+    std::lock_guard<std::mutex> lock(caches_mutex);
 
-        //printf("scanned %d\n", scanned);
-        int first = __builtin_ctzll(mask);
-        assert(first < 64);
-        //printf("mask: %lx, first: %d\n", mask, first);
-        cur->isfree[i] ^= (1L << first);
+    thread_cache = new ThreadCache(this, thread_caches);
+    thread_caches = thread_cache;
+    return thread_cache;
+}
 
-        int idx = first + i * 64;
+void Heap::flushThreadCaches() {
+    for (ThreadCache* c = thread_caches; c; c = c->next_cache) {
+        c->flush();
+    }
+}
 
-        //printf("Using index %d\n", idx);
+ThreadCache::ThreadCache(Heap* heap, ThreadCache* next_cache) : heap(heap), num_recycled(0), next_cache(next_cache) {
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        blocks[i] = NULL;
+        free_masks[i] = 0;
+        words[i] = 0;
+    }
+}
 
-        void* rtn = &cur->atoms[idx];
+void* ThreadCache::allocSlow(int bucket_idx) {
+    size_t size = sizes[bucket_idx];
+    // This might run a collection, which will flush this cache:
+    _collectIfNeeded(0);
 
-#ifndef NDEBUG
-        Block *b = Block::forPointer(rtn);
-        assert(b == cur);
-        int offset = (char*)rtn - (char*)b;
-        assert(offset % rounded_size == 0);
-#endif
+    Block* b = blocks[bucket_idx];
+    while (true) {
+        if (b == NULL)
+            b = blocks[bucket_idx] = heap->takeBlockForCache(bucket_idx, this);
 
-#ifdef VALGRIND
-        VALGRIND_MEMPOOL_ALLOC(cur, rtn, rounded_size);
-#endif
+        for (int word = b->first_free_word; word < BITFIELD_ELTS; word++) {
+            uint64_t mask = b->isfree[word];
+            if (mask == 0)
+                continue;
 
-        return rtn;
+            // Claim all of the free slots in this word; the ones that don't get used
+            // are given back by flush().
+            b->isfree[word] = 0;
+            b->first_free_word = word + 1;
+            words[bucket_idx] = word;
+            free_masks[bucket_idx] = mask;
+            bytesAllocatedSinceCollection += __builtin_popcountll(mask) * size;
+            return alloc(bucket_idx);
+        }
+
+        heap->releaseCachedBlock(b);
+        b = blocks[bucket_idx] = NULL;
+    }
+}
+
+void ThreadCache::flush() {
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        Block* b = blocks[i];
+        if (!b)
+            continue;
+
+        uint64_t mask = free_masks[i];
+        assert((b->isfree[words[i]] & mask) == 0);
+        b->isfree[words[i]] |= mask;
+        if (mask)
+            noteFreeWord(b, words[i]);
+        bytesAllocatedSinceCollection -= __builtin_popcountll(mask) * sizes[i];
+
+        heap->releaseCachedBlock(b);
+        blocks[i] = NULL;
+        free_masks[i] = 0;
+    }
+
+    // These are dead, so they would get freed by the coming collection anyway; freeing them now
+    // means the collection doesn't have to know about them.
+    static StatCounter sc_unused("gc_recycled_unused");
+    sc_unused.log(num_recycled);
+    for (int i = 0; i < num_recycled; i++) {
+        bytesAllocatedSinceCollection -= heap->getAllocationSize(recycled[i]);
+        heap->free(recycled[i]);
     }
+    num_recycled = 0;
 }
 
 void _freeFrom(void* ptr, Block* b) {
@@ -238,6 +587,12 @@ void _freeFrom(void* ptr, Block* b) {
     uint64_t mask = 1L << bitmap_bit;
     assert((b->isfree[bitmap_idx] & mask) == 0);
     b->isfree[bitmap_idx] ^= mask;
+    noteFreeWord(b, bitmap_idx);
+
+    // Free slots always have their mark bit and flags cleared, so that newly-allocated objects
+    // start out young even if they don't initialize their header:
+    b->marks[bitmap_idx] &= ~mask;
+    clearGCFlags(headerFromObject(ptr));
 
 #ifdef VALGRIND
     VALGRIND_MEMPOOL_FREE(b, ptr);
@@ -249,8 +604,14 @@ static void _freeLargeObj(LargeObj *lobj) {
     if (lobj->next)
         lobj->next->prev = lobj->prev;
 
-    int r = munmap(lobj, lobj->mmap_size());
-    assert(r == 0);
+    setPageKinds(lobj, lobj->mmap_size(), PAGE_UNUSED);
+    releaseLargeMapping(lobj, lobj->mmap_size());
+}
+
+void Heap::setRecycledKind(const AllocationKind* kind) {
+    assert(!kind->finalizer);
+    assert(recycled_kind_id == 0 || recycled_kind_id == kind->kind_id);
+    recycled_kind_id = kind->kind_id;
 }
 
 void Heap::free(void* ptr) {
@@ -262,19 +623,36 @@ void Heap::free(void* ptr) {
 
     assert(small_arena.contains(ptr));
     Block *b = Block::forPointer(ptr);
+    freeSmall(ptr, b);
+}
+
+void Heap::freeSmall(void* ptr, Block* b) {
+    if (b->in_cache) {
+        _freeFrom(ptr, b);
+        return;
+    }
+
+    bool was_full = !hasFreeSpace(b);
     _freeFrom(ptr, b);
+
+    // A full block might be in the full list, where takeBlockForCache won't look for free space:
+    if (was_full) {
+        removeFromList(b);
+        insertIntoList(&heads[bucketForSize(b->size)], b);
+    }
 }
 
 void* Heap::realloc(void* ptr, size_t bytes) {
     if (large_arena.contains(ptr)) {
         LargeObj *lobj = LargeObj::fromPointer(ptr);
 
-        int capacity = lobj->capacity();
+        size_t capacity = lobj->capacity();
         if (capacity >= bytes && capacity < bytes * 2)
             return ptr;
 
         void* rtn = alloc(bytes);
         memcpy(rtn, ptr, std::min(bytes, lobj->obj_size));
+        clearGCFlags(headerFromObject(rtn));
 
         _freeLargeObj(lobj);
         return rtn;
@@ -291,34 +669,44 @@ void* Heap::realloc(void* ptr, size_t bytes) {
     void* rtn = alloc(bytes);
 
     memcpy(rtn, ptr, std::min(bytes, size));
+    clearGCFlags(headerFromObject(rtn));
 
-    _freeFrom(ptr, b);
+    freeSmall(ptr, b);
     return rtn;
 }
 
-void* Heap::getAllocationFromInteriorPointer(void* ptr) {
-    if (large_arena.contains(ptr)) {
-        LargeObj *cur = large_head;
-        while (cur) {
-            if (ptr >= cur && ptr < &cur->data[cur->obj_size])
-                return &cur->data[0];
-            cur = cur->next;
-        }
+void* Heap::getAllocationFromHeapPointer(void* ptr) {
+    assert(isHeapPointer(ptr));
+    // Nothing has been allocated yet:
+    if (!page_kinds)
         return NULL;
-    }
 
-    if (!small_arena.contains(ptr))
+    uint8_t* page_kind = pageKindFor(ptr);
+    int kind = *page_kind;
+    if (kind == PAGE_UNUSED)
         return NULL;
 
+    if (kind >= PAGE_LARGE_REST) {
+        uint32_t start_page = large_start_pages[((uintptr_t)ptr - LARGE_ARENA_START) / PAGE_SIZE];
+        LargeObj* lobj = (LargeObj*)(LARGE_ARENA_START + start_page * (uintptr_t)PAGE_SIZE);
+        assert(*pageKindFor(lobj) == PAGE_LARGE_START);
+        if (ptr >= &lobj->data[lobj->obj_size])
+            return NULL;
+        return &lobj->data[0];
+    }
+
+    int bucket_idx = kind - 1;
     Block *b = Block::forPointer(ptr);
-    size_t size = b->size;
+    assert(b->size == sizes[bucket_idx]);
+
     int offset = (char*)ptr - (char*)b;
-    int obj_idx = offset / size;
+    int obj_idx = divideBySize(offset, bucket_idx);
 
-    if (obj_idx < b->minObjIndex() || obj_idx >= b->numObjects())
+    if (obj_idx < divideBySize(BLOCK_HEADER_SIZE + sizes[bucket_idx] - 1, bucket_idx)
+            || (obj_idx + 1) * sizes[bucket_idx] > BLOCK_SIZE)
         return NULL;
 
-    int atom_idx = obj_idx * (size / ATOM_SIZE);
+    int atom_idx = obj_idx * (sizes[bucket_idx] / ATOM_SIZE);
 
     int bitmap_idx = atom_idx / 64;
     int bitmap_bit = atom_idx % 64;
@@ -329,54 +717,140 @@ void* Heap::getAllocationFromInteriorPointer(void* ptr) {
     return &b->atoms[atom_idx];
 }
 
-static long freeChain(Block* head) {
-    long bytes_freed = 0;
-    while (head) {
-        int num_objects = head->numObjects();
-        int first_obj = head->minObjIndex();
-        int atoms_per_obj = head->atomsPerObj();
+size_t Heap::getAllocationSize(void* ptr) {
+    if (large_arena.contains(ptr))
+        return LargeObj::fromPointer(ptr)->obj_size;
 
-        for (int obj_idx = first_obj; obj_idx < num_objects; obj_idx++) {
-            int atom_idx = obj_idx * atoms_per_obj;
-            int bitmap_idx = atom_idx / 64;
-            int bitmap_bit = atom_idx % 64;
-            uint64_t mask = 1L << bitmap_bit;
+    assert(small_arena.contains(ptr));
+    return Block::forPointer(ptr)->size;
+}
 
-            if (head->isfree[bitmap_idx] & mask)
-                continue;
+// Calls f on every allocated object in the block
+template <typename F>
+static void forEachObject(Block* b, F f) {
+    int num_objects = b->numObjects();
+    int first_obj = b->minObjIndex();
+    int atoms_per_obj = b->atomsPerObj();
 
-            void *p = &head->atoms[atom_idx];
-            GCObjectHeader* header = headerFromObject(p);
+    for (int obj_idx = first_obj; obj_idx < num_objects; obj_idx++) {
+        int atom_idx = obj_idx * atoms_per_obj;
+        int bitmap_idx = atom_idx / 64;
+        int bitmap_bit = atom_idx % 64;
+        uint64_t mask = 1L << bitmap_bit;
 
-            if (isMarked(header)) {
-                clearMark(header);
-            } else {
-                if (VERBOSITY() >= 2) printf("Freeing %p\n", p);
-                //assert(p != (void*)0x127000d960); // the main module
-                bytes_freed += head->size;
-                head->isfree[bitmap_idx] |= mask;
-            }
+        if (b->isfree[bitmap_idx] & mask)
+            continue;
+
+        f(&b->atoms[atom_idx], bitmap_idx, mask);
+    }
+}
+
+bool Heap::sweepBlock(Block* b, ThreadCache* recycle_into) {
+    assert(b->needs_sweep);
+
+    // Objects that never got their header initialized would match:
+    if (recycled_kind_id == 0)
+        recycle_into = NULL;
+
+    bool empty = true;
+    int nrecycled = 0;
+    forEachObject(b, [&](void* p, int bitmap_idx, uint64_t mask) {
+        if (b->marks[bitmap_idx] & mask) {
+            empty = false;
+        } else if (recycle_into && headerFromObject(p)->kind_id == recycled_kind_id && recycle_into->addRecycled(p)) {
+            empty = false;
+            nrecycled++;
+        } else {
+            if (VERBOSITY() >= 2) printf("Freeing %p\n", p);
+            //assert(p != (void*)0x127000d960); // the main module
+            bytes_freed += b->size;
+            b->isfree[bitmap_idx] |= mask;
+            noteFreeWord(b, bitmap_idx);
+        }
+    });
+    b->needs_sweep = 0;
+
+    if (nrecycled) {
+        static StatCounter sc_recycled("gc_objects_recycled");
+        sc_recycled.log(nrecycled);
+
+        // Like the slots that a ThreadCache claims, these count as allocated as soon as they're
+        // in the cache, and flush() takes back the ones that didn't get used:
+        bytesAllocatedSinceCollection += nrecycled * b->size;
+
+        // The recycled objects will be young once they get reused:
+        if (!b->has_young) {
+            b->has_young = 1;
+            young_blocks.push_back(b);
         }
+    }
+    return empty;
+}
+
+Block* Heap::sweepPending(int bucket_idx, ThreadCache* recycle_into) {
+    std::vector<Block*> &pending = to_sweep[bucket_idx];
+    while (pending.size()) {
+        Block* b = pending.back();
+        pending.pop_back();
+
+        // takeBlockForCache might have already swept it
+        if (!b->needs_sweep)
+            continue;
+
+        if (sweepBlock(b, recycle_into)) {
+            poolEmptyBlock(b);
+            continue;
+        }
+
+        if (hasFreeSpace(b)) {
+            removeFromList(b);
+            insertIntoList(&heads[bucket_idx], b);
+            return b;
+        }
+    }
+    return NULL;
+}
+
+void Heap::sweepSomePending() {
+    static StatCounter sc_paced("gc_blocks_swept_paced");
 
+    int nswept = 0;
+    for (int i = 0; i < NUM_BUCKETS && nswept < SWEEP_BLOCKS_PER_NEW_BLOCK; i++) {
+        while (nswept < SWEEP_BLOCKS_PER_NEW_BLOCK && sweepPending(next_sweep_bucket))
+            nswept++;
+
+        if (nswept < SWEEP_BLOCKS_PER_NEW_BLOCK)
+            next_sweep_bucket = (next_sweep_bucket + 1) % NUM_BUCKETS;
+    }
+    sc_paced.log(nswept);
+}
+
+static void clearChainMarks(Block* head) {
+    while (head) {
+        memset(head->marks, 0, sizeof(Block::marks));
         head = head->next;
     }
-    return bytes_freed;
 }
 
-void Heap::freeUnmarked() {
-    long bytes_freed = 0;
+void Heap::clearMarks() {
     for (int bidx = 0; bidx < NUM_BUCKETS; bidx++) {
-        bytes_freed += freeChain(heads[bidx]);
-        bytes_freed += freeChain(full_heads[bidx]);
+        clearChainMarks(heads[bidx]);
+        clearChainMarks(full_heads[bidx]);
     }
 
-    LargeObj *cur = large_head;
+    for (LargeObj *cur = large_head; cur; cur = cur->next) {
+        clearGCFlags(headerFromObject(cur->data));
+    }
+}
+
+// Large objects aren't separated by generation, so both kinds of collections
+// have to look at all of them.
+static long sweepLargeObjs(LargeObj *cur) {
+    long bytes_freed = 0;
     while (cur) {
         void *p = cur->data;
         GCObjectHeader* header = headerFromObject(p);
-        if (isMarked(header)) {
-            clearMark(header);
-        } else {
+        if (!isMarked(header)) {
             if (VERBOSITY() >= 2) printf("Freeing %p\n", p);
             bytes_freed += cur->mmap_size();
 
@@ -391,8 +865,99 @@ void Heap::freeUnmarked() {
 
         cur = cur->next;
     }
+    return bytes_freed;
+}
+
+static void queueChain(Block* head, std::vector<Block*> &to_sweep) {
+    while (head) {
+        assert(!head->needs_sweep);
+        head->has_young = 0;
+        head->needs_sweep = 1;
+        to_sweep.push_back(head);
+        head = head->next;
+    }
+}
+
+void Heap::startSweep(bool young_only) {
+    if (young_only) {
+        for (Block* b : young_blocks) {
+            assert(!b->needs_sweep);
+            b->has_young = 0;
+            b->needs_sweep = 1;
+            to_sweep[bucketForSize(b->size)].push_back(b);
+        }
+    } else {
+        for (int bidx = 0; bidx < NUM_BUCKETS; bidx++) {
+            queueChain(heads[bidx], to_sweep[bidx]);
+            queueChain(full_heads[bidx], to_sweep[bidx]);
+        }
+    }
+    young_blocks.clear();
+
+    bytes_freed += sweepLargeObjs(large_head);
+}
+
+void Heap::finishSweep() {
+    static StatCounter sc_finished("gc_blocks_swept_at_collection");
+
+    for (int bidx = 0; bidx < NUM_BUCKETS; bidx++) {
+        for (Block* b : to_sweep[bidx]) {
+            if (!b->needs_sweep)
+                continue;
+
+            sc_finished.log();
+            if (sweepBlock(b)) {
+                poolEmptyBlock(b);
+            } else if (hasFreeSpace(b)) {
+                removeFromList(b);
+                insertIntoList(&heads[bidx], b);
+            }
+        }
+        to_sweep[bidx].clear();
+    }
+
+    releaseEmptyBlocks();
+}
 
-    if (VERBOSITY("gc") >= 2) if (bytes_freed) printf("Freed %ld bytes\n", bytes_freed);
+static void addChainOccupancy(Block* head, BucketOccupancy* occupancy) {
+    for (Block* b = head; b; b = b->next) {
+        long slots = b->numObjects() - b->minObjIndex();
+        long free_slots = 0;
+        for (int i = 0; i < BITFIELD_ELTS; i++) {
+            free_slots += __builtin_popcountll(b->isfree[i]);
+        }
+
+        occupancy->blocks++;
+        occupancy->slots += slots;
+        occupancy->used_slots += slots - free_slots;
+    }
+}
+
+void Heap::getOccupancy(HeapOccupancy* occupancy) {
+    // Blocks that thread caches are using aren't in any list:
+    flushThreadCaches();
+
+    for (int bidx = 0; bidx < NUM_BUCKETS; bidx++) {
+        addChainOccupancy(heads[bidx], &occupancy->buckets[bidx]);
+        addChainOccupancy(full_heads[bidx], &occupancy->buckets[bidx]);
+    }
+
+    occupancy->empty_blocks = empty_blocks.size();
+    occupancy->released_blocks = released_blocks.size();
+
+    for (LargeObj *cur = large_head; cur; cur = cur->next) {
+        occupancy->large_objects++;
+        occupancy->large_bytes += cur->obj_size;
+        occupancy->large_mapped_bytes += cur->mmap_size();
+    }
+}
+
+long Heap::takeBytesFreed() {
+    long rtn = bytes_freed;
+    bytes_freed = 0;
+
+    if (VERBOSITY("gc") >= 2) if (rtn) printf("Freed %ld bytes\n", rtn);
+    return rtn;
 }
 
 }
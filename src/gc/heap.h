@@ -16,12 +16,34 @@
 #define PYSTON_GC_HEAP_H
 
 #include <cstdint>
+#include <vector>
 
 #include "core/common.h"
+#include "core/stats.h"
+#include "core/types.h"
+
+#ifdef VALGRIND
+#include "valgrind.h"
+#endif
 
 namespace pyston {
 namespace gc {
 
+// The heap reserves this much address space for each of its arenas:
+#define ARENA_SIZE 0x1000000000L
+#define SMALL_ARENA_START 0x1270000000L
+#define LARGE_ARENA_START 0x2270000000L
+
+inline bool isSmallArenaPointer(void* p) {
+    return (uintptr_t)p - SMALL_ARENA_START < ARENA_SIZE;
+}
+
+static_assert(LARGE_ARENA_START == SMALL_ARENA_START + ARENA_SIZE, "the arenas should be next to each other");
+// Whether p is inside either of the arenas, with a single comparison:
+inline bool isHeapPointer(void* p) {
+    return (uintptr_t)p - SMALL_ARENA_START < 2 * ARENA_SIZE;
+}
+
 #define BLOCK_SIZE 4096
 #define ATOM_SIZE 16
 static_assert(BLOCK_SIZE % ATOM_SIZE == 0, "");
@@ -30,7 +52,7 @@ static_assert(ATOMS_PER_BLOCK % 64 == 0, "");
 #define BITFIELD_SIZE (ATOMS_PER_BLOCK / 8)
 #define BITFIELD_ELTS (BITFIELD_SIZE / 8)
 
-#define BLOCK_HEADER_SIZE (BITFIELD_SIZE + 2 * sizeof(void*) + sizeof(uint64_t))
+#define BLOCK_HEADER_SIZE (2 * BITFIELD_SIZE + 2 * sizeof(void*) + sizeof(uint64_t) + 4 * sizeof(uint16_t))
 #define BLOCK_HEADER_ATOMS ((BLOCK_HEADER_SIZE + ATOM_SIZE - 1) / ATOM_SIZE)
 
 struct Atoms {
@@ -42,7 +64,20 @@ struct Block {
         struct {
             Block *next, **prev;
             uint64_t size;
+            // Whether anything has been allocated in this block since the last collection,
+            // ie whether it's in Heap::young_blocks:
+            uint16_t has_young;
+            // Whether the last collection marked this block's objects but hasn't freed the
+            // unmarked ones yet, ie whether it's in Heap::to_sweep:
+            uint16_t needs_sweep;
+            // Whether a ThreadCache is allocating out of this block; if so, it isn't in any
+            // of the Heap's lists.
+            uint16_t in_cache;
+            // All of the isfree words before this one are known to be zero:
+            uint16_t first_free_word;
             uint64_t isfree[BITFIELD_ELTS];
+            // The mark bits of the objects in this block, indexed the same way as isfree.
+            uint64_t marks[BITFIELD_ELTS];
         };
         Atoms atoms[ATOMS_PER_BLOCK];
     };
@@ -62,6 +97,15 @@ struct Block {
     static Block* forPointer(void* ptr) {
         return (Block*)((uintptr_t)ptr & ~(BLOCK_SIZE-1));
     }
+
+    // Finds the word and bit in isfree and marks that correspond to the object at ptr:
+    static Block* bitForPointer(void* ptr, int* word, uint64_t* mask) {
+        Block* b = forPointer(ptr);
+        int atom_idx = ((char*)ptr - (char*)b) / ATOM_SIZE;
+        *word = atom_idx / 64;
+        *mask = 1L << (atom_idx % 64);
+        return b;
+    }
 };
 static_assert(sizeof(Block) == BLOCK_SIZE, "bad size");
 
@@ -76,44 +120,213 @@ constexpr const size_t sizes[] = {
 };
 #define NUM_BUCKETS (sizeof(sizes) / sizeof(sizes[0]))
 
+#define MAX_SMALL_ATOMS (2048 / ATOM_SIZE)
+static_assert(sizes[NUM_BUCKETS - 1] == MAX_SMALL_ATOMS * ATOM_SIZE, "");
+
+constexpr int sizeClassForAtoms(size_t atoms, int i = 0) {
+    return (i == NUM_BUCKETS - 1 || sizes[i] >= atoms * ATOM_SIZE) ? i : sizeClassForAtoms(atoms, i + 1);
+}
+
+// Maps an object size, in atoms (rounded up), to its size class:
+#define SC1(n) sizeClassForAtoms(n)
+#define SC8(n) SC1(n), SC1(n + 1), SC1(n + 2), SC1(n + 3), SC1(n + 4), SC1(n + 5), SC1(n + 6), SC1(n + 7)
+#define SC32(n) SC8(n), SC8(n + 8), SC8(n + 16), SC8(n + 24)
+constexpr const uint8_t size_classes[MAX_SMALL_ATOMS + 1] = {
+    SC32(0), SC32(32), SC32(64), SC32(96), SC1(128)
+};
+#undef SC1
+#undef SC8
+#undef SC32
+
+inline int sizeClassFor(size_t bytes) {
+    return size_classes[(bytes + ATOM_SIZE - 1) / ATOM_SIZE];
+}
+
+class Heap;
+
+// Sweeping can set aside the dead objects of one kind (see Heap::setRecycledKind) instead of freeing
+// them, up to this many per thread; allocating one of those doesn't have to touch any blocks, and
+// reuses memory that was touched recently.
+#define RECYCLE_LIST_SIZE 256
+
+// Per-thread allocation cache.  For each size class, it takes a block off of the Heap's lists
+// and claims that block's free slots one bitfield word at a time; allocations then come out of
+// the claimed mask, without touching any of the Heap's state.
+// Caches get flushed back into the Heap at the start of every collection, since the claimed
+// slots look allocated to everything else.
+class ThreadCache {
+    private:
+        Heap* const heap;
+        Block* blocks[NUM_BUCKETS];
+        // The claimed free slots, from blocks[i]->isfree[words[i]]:
+        uint64_t free_masks[NUM_BUCKETS];
+        int words[NUM_BUCKETS];
+        // Still allocated, as far as their blocks are concerned:
+        void* recycled[RECYCLE_LIST_SIZE];
+        int num_recycled;
+
+        NOINLINE void* allocSlow(int bucket_idx);
+
+    public:
+        ThreadCache* const next_cache;
+
+        ThreadCache(Heap* heap, ThreadCache* next_cache);
+
+        // This is the allocation fast path; it's small enough to get inlined everywhere,
+        // including into jitted code (see runtime/inline/gc_runtime.cpp).
+        ALWAYSINLINE void* alloc(int bucket_idx) {
+            uint64_t mask = free_masks[bucket_idx];
+            if (__builtin_expect(mask == 0, 0))
+                return allocSlow(bucket_idx);
+
+            free_masks[bucket_idx] = mask & (mask - 1);
+            Block* b = blocks[bucket_idx];
+            void* rtn = &b->atoms[words[bucket_idx] * 64 + __builtin_ctzll(mask)];
+#ifdef VALGRIND
+            VALGRIND_MEMPOOL_ALLOC(b, rtn, b->size);
+#endif
+            return rtn;
+        }
+
+        // Returns a dead object of the recycled kind, which has to be completely reinitialized,
+        // or NULL if there aren't any.  This gets inlined into jitted code, so it doesn't log
+        // any stats: the hits are gc_objects_recycled minus gc_recycled_unused.
+        ALWAYSINLINE void* takeRecycled() {
+            if (num_recycled == 0)
+                return NULL;
+            return recycled[--num_recycled];
+        }
+
+        // Returns false if the list is full.
+        bool addRecycled(void* p) {
+            if (num_recycled == RECYCLE_LIST_SIZE)
+                return false;
+            recycled[num_recycled++] = p;
+            return true;
+        }
+
+        // Gives the cached blocks, and their unused claimed slots, back to the heap; the recycled
+        // objects get freed.
+        void flush();
+};
+
+// How full the blocks of a size class are, for reporting fragmentation:
+struct BucketOccupancy {
+    long blocks = 0;
+    long slots = 0;
+    long used_slots = 0;
+};
+
+struct HeapOccupancy {
+    BucketOccupancy buckets[NUM_BUCKETS];
+    long empty_blocks = 0, released_blocks = 0;
+    long large_objects = 0, large_bytes = 0, large_mapped_bytes = 0;
+};
+
 class LargeObj;
 class Heap {
     private:
         Block* heads[NUM_BUCKETS];
         Block* full_heads[NUM_BUCKETS];
         LargeObj *large_head = NULL;
+        // Blocks that have had objects allocated out of them since the last collection;
+        // these are the only blocks that a minor collection needs to sweep.
+        std::vector<Block*> young_blocks;
+        // Sweeping is done lazily: at the end of a collection, the blocks that need sweeping
+        // get added to the list for their size class, and takeBlockForCache sweeps them as it needs
+        // more space.  Whatever is left gets swept at the beginning of the next collection.
+        std::vector<Block*> to_sweep[NUM_BUCKETS];
+        int next_sweep_bucket = 0;
+        long bytes_freed = 0;
+        ThreadCache* thread_caches = NULL;
+        // 0 (ie nothing) until setRecycledKind gets called:
+        kindid_t recycled_kind_id = 0;
+        // Blocks that sweeping found to be completely empty, which can get reused by any size
+        // class.  Only GC_EMPTY_BLOCKS_MB worth of them are kept resident; the pages of the
+        // rest are given back to the OS (but stay reserved) and moved to released_blocks.
+        std::vector<Block*> empty_blocks;
+        std::vector<Block*> released_blocks;
+
+        static __thread ThreadCache* thread_cache;
+        // Not inline, so that code that inlines the allocation fast path (including the jit,
+        // through the stdlib bitcode) doesn't need to be able to access thread-local storage.
+        ThreadCache* getThreadCache();
 
-        void* allocSmall(size_t rounded_size, Block **head, Block **full_head);
         void* allocLarge(size_t bytes);
 
+        Block* allocBlock(uint64_t size);
+        void poolEmptyBlock(Block* b);
+        size_t maxResidentEmptyBlocks();
+        void releaseEmptyBlocks();
+
+        void freeSmall(void* ptr, Block* b);
+
+        // getAllocationFromInteriorPointer, for pointers that are known to be inside the arenas:
+        void* getAllocationFromHeapPointer(void* ptr);
+
+        // Returns whether the block is completely empty now.  If recycle_into is given, dead
+        // objects of the recycled kind get added to it rather than freed.
+        bool sweepBlock(Block* b, ThreadCache* recycle_into=NULL);
+        // Sweeps a block from to_sweep and puts it back in the usable list if it has
+        // free space now; returns NULL if there was nothing left to sweep.
+        Block* sweepPending(int bucket_idx, ThreadCache* recycle_into=NULL);
+        // Does a bit of sweeping in other size classes, to pace sweeping with allocation:
+        void sweepSomePending();
+
     public:
         void* realloc(void* ptr, size_t bytes);
 
-        void* alloc(size_t bytes) {
+        ALWAYSINLINE void* alloc(size_t bytes) {
             //assert(bytes >= 16);
-            if (bytes == 16)
-                return allocSmall(16, &heads[0], &full_heads[0]);
-            if (bytes <= 32)
-                return allocSmall(32, &heads[1], &full_heads[1]);
-
             if (bytes > sizes[NUM_BUCKETS-1]) {
                 return allocLarge(bytes);
             }
 
-            for (int i = 2; i < NUM_BUCKETS; i++) {
-                if (sizes[i] >= bytes) {
-                    return allocSmall(sizes[i], &heads[i], &full_heads[i]);
-                }
-            }
-
-            //unreachable
-            abort();
+            return getThreadCache()->alloc(sizeClassFor(bytes));
         }
 
+        // Used by ThreadCache to get a block of the given size class to allocate out of,
+        // and to give it back once it's full (or at a collection).
+        Block* takeBlockForCache(int bucket_idx, ThreadCache* cache);
+        void releaseCachedBlock(Block* b);
+        void flushThreadCaches();
+
         void free(void* ptr);
 
-        void* getAllocationFromInteriorPointer(void* ptr);
-        void freeUnmarked();
+        // Lets sweeping recycle dead objects of this kind (which can't have a finalizer), for
+        // allocRecycled to hand back out.
+        void setRecycledKind(const AllocationKind* kind);
+        ALWAYSINLINE void* allocRecycled() {
+            return getThreadCache()->takeRecycled();
+        }
+
+        // Conservative scanning calls this on every word it looks at, and most of those don't
+        // point into the heap at all, so those get rejected inline.
+        void* getAllocationFromInteriorPointer(void* ptr) {
+            if (!isHeapPointer(ptr))
+                return NULL;
+            return getAllocationFromHeapPointer(ptr);
+        }
+        // The usable size of an allocation; ptr has to point to the start of it.
+        size_t getAllocationSize(void* ptr);
+
+        // Unmark every object, moving everything back to the young generation.
+        // Called at the beginning of a major collection.  This doesn't touch the small objects
+        // themselves, so it doesn't clear their remembered bits.
+        void clearMarks();
+        // Start freeing the unmarked objects, either in the whole heap or just the
+        // ones allocated since the last collection; the marked ones are left marked (old).
+        // Large objects get freed right away, but blocks are queued for lazy sweeping.
+        void startSweep(bool young_only);
+        // Sweep all the blocks that are still queued.  Has to be called before the next
+        // mark phase, since the unswept blocks still contain dead objects.
+        void finishSweep();
+        // Returns the number of bytes that have been freed by sweeping since the last call.
+        long takeBytesFreed();
+
+        // Blocks that are still waiting to be swept count their dead objects as used, so
+        // this should be called after finishSweep() for accurate numbers.
+        void getOccupancy(HeapOccupancy* occupancy);
 };
 
 extern Heap global_heap;
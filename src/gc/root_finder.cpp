@@ -19,9 +19,11 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cassert>
+#include <map>
 #include <vector>
 
 #include "core/common.h"
+#include "core/stats.h"
 
 #include "codegen/codegen.h"
 #include "codegen/llvm_interpreter.h"
@@ -47,6 +49,115 @@ void collectRoots(void* start, void* end, TraceStack* stack) {
     }
 }
 
+// Keyed by the end address of the patchpoint:
+typedef std::map<void*, std::pair<void*, PreciseFrameRoots*> > PreciseRootsMap;
+static PreciseRootsMap precise_roots_by_end_addr;
+
+void registerPreciseFrameRoots(void* start_addr, void* end_addr, PreciseFrameRoots* roots) {
+    assert(start_addr < end_addr);
+    assert(precise_roots_by_end_addr.count(end_addr) == 0);
+    precise_roots_by_end_addr[end_addr] = std::make_pair(start_addr, roots);
+}
+
+void unregisterPreciseFrameRoots(void* start_addr, void* end_addr) {
+    PreciseRootsMap::iterator it = precise_roots_by_end_addr.upper_bound(start_addr);
+    while (it != precise_roots_by_end_addr.end() && it->first <= end_addr) {
+        assert(it->second.first >= start_addr);
+        delete it->second.second;
+        it = precise_roots_by_end_addr.erase(it);
+    }
+}
+
+static PreciseFrameRoots* getPreciseFrameRoots(void* ip) {
+    // ip is a return address, so it can be equal to the end of the patchpoint but not the start.
+    PreciseRootsMap::iterator it = precise_roots_by_end_addr.lower_bound(ip);
+    if (it == precise_roots_by_end_addr.end() || ip <= it->second.first)
+        return NULL;
+    return it->second.second;
+}
+
+static void collectPotentialRoot(void* p, TraceStack* stack) {
+    void* a = global_heap.getAllocationFromInteriorPointer(p);
+    if (a)
+        stack->push(a);
+}
+
+// Whether libunwind can recover every register that the frame's roots are in.  Caller-save
+// registers only get recorded for PreserveAll patchpoints, which spill them into the frame before
+// calling out, so if one of those isn't recoverable the frame can still be scanned conservatively.
+static bool preciseFrameRootsRecoverable(unw_cursor_t* cursor, PreciseFrameRoots* roots) {
+    for (const FrameRootLocation &l : roots->locations) {
+        if (l.kind == FrameRootLocation::Constant)
+            continue;
+
+        unw_word_t reg;
+        if (unw_get_reg(cursor, l.regnum, &reg) != 0)
+            return false;
+    }
+    return true;
+}
+
+// Returns the number of words that were looked at.  The registers have to be recoverable (see
+// preciseFrameRootsRecoverable).
+static int collectPreciseFrameRoots(unw_cursor_t* cursor, void* sp, PreciseFrameRoots* roots, TraceStack* stack) {
+    int nwords = roots->num_stack_args;
+    collectRoots(sp, (void**)sp + roots->num_stack_args, stack);
+
+    for (const FrameRootLocation &l : roots->locations) {
+        if (l.kind == FrameRootLocation::Constant) {
+            collectPotentialRoot((void*)l.offset, stack);
+            nwords++;
+            continue;
+        }
+
+        unw_word_t reg;
+        // libunwind uses the dwarf numbering for the x86_64 registers.
+        int r = unw_get_reg(cursor, l.regnum, &reg);
+        RELEASE_ASSERT(r == 0, "couldn't recover register %d", l.regnum);
+
+        switch (l.kind) {
+            case FrameRootLocation::Register:
+                collectPotentialRoot((void*)reg, stack);
+                nwords++;
+                break;
+            case FrameRootLocation::Indirect:
+                collectPotentialRoot(*(void**)(reg + l.offset), stack);
+                nwords++;
+                break;
+            case FrameRootLocation::Direct: {
+                void** start = (void**)(reg + l.offset);
+                void** end = start + l.size / sizeof(void*);
+                collectRoots(start, end, stack);
+                nwords += end - start;
+                break;
+            }
+            default:
+                RELEASE_ASSERT(0, "%d", l.kind);
+        }
+    }
+    return nwords;
+}
+
+// The callee-save registers, in libunwind's (dwarf) numbering:
+static const int callee_save_regs[] = {
+    UNW_X86_64_RBX, UNW_X86_64_RBP, UNW_X86_64_R12, UNW_X86_64_R13, UNW_X86_64_R14, UNW_X86_64_R15,
+};
+
+// A frame's callee-save registers can have gotten spilled by any of the frames below it, and
+// the spill slots of precise frames don't get scanned, so for every frame this gets the values
+// those registers had in it (which libunwind knows how to find).
+static int collectCalleeSaveRegisters(unw_cursor_t* cursor, TraceStack* stack) {
+    int nwords = 0;
+    for (int regnum : callee_save_regs) {
+        unw_word_t reg;
+        if (unw_get_reg(cursor, regnum, &reg) != 0)
+            continue;
+        collectPotentialRoot((void*)reg, stack);
+        nwords++;
+    }
+    return nwords;
+}
+
 void collectStackRoots(TraceStack *stack) {
     unw_cursor_t cursor;
     unw_context_t uc;
@@ -70,6 +181,9 @@ void collectStackRoots(TraceStack *stack) {
     assert(sizeof(registers) % 8 == 0);
     //void* stack_bottom = __builtin_frame_address(0);
     collectRoots(&registers, &registers + 1, stack);
+    int conservative_words = sizeof(registers) / sizeof(void*);
+    int precise_words = 0;
+    int precise_frames = 0, conservative_frames = 0;
 
     unw_getcontext(&uc);
     unw_init_local(&cursor, &uc);
@@ -98,13 +212,39 @@ void collectStackRoots(TraceStack *stack) {
             break;
         }
 
+        conservative_words += collectCalleeSaveRegisters(&cursor, stack);
+
+        PreciseFrameRoots* roots = getPreciseFrameRoots((void*)ip);
+        if (roots) {
+            if (preciseFrameRootsRecoverable(&cursor, roots)) {
+                precise_words += collectPreciseFrameRoots(&cursor, cur_sp, roots, stack);
+                precise_frames++;
+                continue;
+            }
+
+            // Fall back to scanning the whole frame, like any other one:
+            static StatCounter sc_unrecoverable("gc_stack_frames_precise_unrecoverable");
+            sc_unrecoverable.log();
+        }
+
         if (pip.start_ip == (intptr_t)interpretFunction) {
             // TODO Do we still need to crawl the interpreter itself?
             gatherInterpreterRootsForFrame(&visitor, cur_bp);
         }
 
         collectRoots(cur_sp, (char*)cur_bp, stack);
+        conservative_words += ((char*)cur_bp - (char*)cur_sp) / sizeof(void*);
+        conservative_frames++;
     }
+
+    static StatCounter sc_precise_words("gc_stack_words_precise");
+    sc_precise_words.log(precise_words);
+    static StatCounter sc_conservative_words("gc_stack_words_conservative");
+    sc_conservative_words.log(conservative_words);
+    static StatCounter sc_precise_frames("gc_stack_frames_precise");
+    sc_precise_frames.log(precise_frames);
+    static StatCounter sc_conservative_frames("gc_stack_frames_conservative");
+    sc_conservative_frames.log(conservative_frames);
 }
 
 }
@@ -15,12 +15,45 @@
 #ifndef PYSTON_GC_ROOTFINDER_H
 #define PYSTON_GC_ROOTFINDER_H
 
+#include <stdint.h>
+#include <vector>
+
 namespace pyston {
 namespace gc {
 
 class TraceStack;
 void collectStackRoots(TraceStack*);
 
+// Where the gc roots of a jitted frame are, while that frame is stopped inside a particular
+// patchpoint.  This gets built from the llvm stackmap record for the patchpoint; register
+// numbers are dwarf register numbers.
+struct FrameRootLocation {
+    enum Kind {
+        Register,   // the value is in the register
+        Indirect,   // the value is stored at [reg + offset]
+        Direct,     // there is a stack slot of `size` bytes at reg + offset
+        Constant,   // the value is `offset`
+    };
+
+    Kind kind;
+    int regnum;
+    int64_t offset;
+    int size;
+};
+
+struct PreciseFrameRoots {
+    std::vector<FrameRootLocation> locations;
+    // Number of words of outgoing call arguments at the bottom of the frame:
+    int num_stack_args;
+};
+
+// Registers the roots for a frame whose return address is in (start_addr, end_addr].
+// Frames that are stopped anywhere else get scanned conservatively.
+void registerPreciseFrameRoots(void* start_addr, void* end_addr, PreciseFrameRoots* roots);
+// Drops (and frees) the roots of all the patchpoints in [start_addr, end_addr), for when the
+// code there gets freed.
+void unregisterPreciseFrameRoots(void* start_addr, void* end_addr);
+
 }
 }
 
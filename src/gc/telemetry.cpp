@@ -0,0 +1,221 @@
+// Copyright (c) 2014 Dropbox, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <dlfcn.h>
+
+#include "core/common.h"
+#include "core/options.h"
+
+#include "gc/heap.h"
+#include "gc/telemetry.h"
+
+namespace pyston {
+namespace gc {
+
+// Histogram of pause times, on a log scale with four buckets per power of two so that it takes
+// constant space no matter how long the process runs; the percentiles it reports are upper
+// bounds that are within 25% of the real value.
+#define NUM_PAUSE_BUCKETS (4 * 48)
+class PauseHistogram {
+    private:
+        long counts[NUM_PAUSE_BUCKETS] = {};
+        long count = 0, total_us = 0, max_us = 0;
+
+        static int bucketFor(long us) {
+            if (us < 4)
+                return us;
+            int log = 63 - __builtin_clzl(us);
+            return 4 * (log - 1) + ((us >> (log - 2)) & 3);
+        }
+
+        static long bucketMax(int bucket) {
+            if (bucket < 4)
+                return bucket;
+            int log = bucket / 4 + 1;
+            long min = (long)(4 + bucket % 4) << (log - 2);
+            return min + (1L << (log - 2)) - 1;
+        }
+
+    public:
+        void add(long us) {
+            us = std::max(us, 0L);
+            counts[std::min(bucketFor(us), NUM_PAUSE_BUCKETS - 1)]++;
+            count++;
+            total_us += us;
+            max_us = std::max(max_us, us);
+        }
+
+        long percentile(int pct) {
+            long needed = (count * pct + 99) / 100;
+            long seen = 0;
+            for (int i = 0; i < NUM_PAUSE_BUCKETS; i++) {
+                seen += counts[i];
+                if (seen >= needed && seen > 0)
+                    return std::min(bucketMax(i), max_us);
+            }
+            return max_us;
+        }
+
+        void dump(const char* name) {
+            if (count == 0)
+                return;
+            printf("  %s: %ld collections, %ldus total, avg %ldus, p50 %ldus, p90 %ldus, p99 %ldus, max %ldus\n", name,
+                    count, total_us, total_us / count, percentile(50), percentile(90), percentile(99), max_us);
+        }
+};
+
+static PauseHistogram minor_pauses, major_pauses;
+static long total_mark_us[2], total_sweep_us[2];
+
+// The most recent collections, so that the dump can show what the collector has been doing lately:
+#define RECENT_EVENTS 16
+static CollectionEvent recent[RECENT_EVENTS];
+static int num_events = 0;
+
+struct KindTotals {
+    const AllocationKind* kind;
+    long count, bytes;
+};
+static std::vector<KindTotals> live_kinds;
+
+static FILE* event_log = NULL;
+
+static void writeEvent(const CollectionEvent &e) {
+    fprintf(event_log, "{\"n\": %d, \"type\": \"%s\", \"start_us\": %ld, \"pause_us\": %ld, \"mark_us\": %ld, "
+            "\"sweep_us\": %ld, \"allocated_bytes\": %ld, \"marked_bytes\": %ld, \"freed_bytes\": %ld}\n",
+            e.number, e.major ? "major" : "minor", e.start_us, e.pause_us, e.mark_us, e.sweep_us,
+            e.allocated_bytes, e.marked_bytes, e.freed_bytes);
+    fflush(event_log);
+}
+
+// The last collection doesn't get logged until we know how much it freed; if the process
+// ends first, log it with what has been freed so far.
+static void flushEventLog() {
+    if (num_events)
+        writeEvent(recent[(num_events - 1) % RECENT_EVENTS]);
+    fclose(event_log);
+    event_log = NULL;
+}
+
+static void openEventLog() {
+    static bool opened = false;
+    if (opened)
+        return;
+    opened = true;
+
+    if (!GC_EVENT_LOG)
+        return;
+
+    event_log = fopen(GC_EVENT_LOG, "w");
+    RELEASE_ASSERT(event_log, "couldn't open %s", GC_EVENT_LOG);
+    atexit(flushEventLog);
+}
+
+void recordBytesFreed(long freed_bytes) {
+    if (num_events == 0)
+        return;
+
+    CollectionEvent &last = recent[(num_events - 1) % RECENT_EVENTS];
+    last.freed_bytes += freed_bytes;
+    if (event_log)
+        writeEvent(last);
+}
+
+void recordCollection(const CollectionEvent &event) {
+    openEventLog();
+
+    recent[num_events % RECENT_EVENTS] = event;
+    num_events++;
+
+    (event.major ? major_pauses : minor_pauses).add(event.pause_us);
+    total_mark_us[event.major] += event.mark_us;
+    total_sweep_us[event.major] += event.sweep_us;
+}
+
+void recordLiveKinds(const AllocationKind* const* kinds, const long* counts, const long* bytes, int num_kinds) {
+    live_kinds.clear();
+    for (int i = 0; i < num_kinds; i++) {
+        if (counts[i])
+            live_kinds.push_back(KindTotals{kinds[i], counts[i], bytes[i]});
+    }
+}
+
+static std::string kindName(const AllocationKind* kind) {
+    Dl_info info;
+    if (dladdr((void*)kind, &info) && info.dli_sname)
+        return info.dli_sname;
+
+    char buf[40];
+    snprintf(buf, sizeof(buf), "kind %d", kind->kind_id);
+    return buf;
+}
+
+void dumpTelemetry() {
+    printf("GC telemetry:\n");
+
+    printf("Pauses:\n");
+    minor_pauses.dump("minor");
+    major_pauses.dump("major");
+    for (int major = 0; major < 2; major++) {
+        long total = total_mark_us[major] + total_sweep_us[major];
+        if (total)
+            printf("  %s mark/sweep split: %ldus marking (%ld%%), %ldus sweeping\n", major ? "major" : "minor",
+                    total_mark_us[major], total_mark_us[major] * 100 / total, total_sweep_us[major]);
+    }
+
+    printf("Recent collections:\n");
+    for (int i = std::max(0, num_events - RECENT_EVENTS); i < num_events; i++) {
+        const CollectionEvent &e = recent[i % RECENT_EVENTS];
+        printf("  #%d %s at %ldms: %ldus pause (%ldus mark, %ldus sweep), %ld allocated, %ld marked, %ld freed\n",
+                e.number, e.major ? "major" : "minor", e.start_us / 1000, e.pause_us, e.mark_us, e.sweep_us,
+                e.allocated_bytes, e.marked_bytes, e.freed_bytes);
+    }
+
+    if (live_kinds.size()) {
+        printf("Live objects by kind, as of the last major collection:\n");
+        std::sort(live_kinds.begin(), live_kinds.end(), [](const KindTotals &a, const KindTotals &b) {
+            return a.bytes > b.bytes;
+        });
+        for (const KindTotals &k : live_kinds) {
+            printf("  %s: %ld objects, %ld bytes\n", kindName(k.kind).c_str(), k.count, k.bytes);
+        }
+    }
+
+    // Blocks queued for lazy sweeping would count their dead objects as used:
+    global_heap.finishSweep();
+    HeapOccupancy occupancy;
+    global_heap.getOccupancy(&occupancy);
+
+    printf("Size class occupancy:\n");
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        const BucketOccupancy &b = occupancy.buckets[i];
+        if (b.blocks == 0)
+            continue;
+        printf("  %4ld bytes: %ld blocks, %ld/%ld slots used (%ld%% fragmented)\n", (long)sizes[i], b.blocks,
+                b.used_slots, b.slots, 100 - b.used_slots * 100 / b.slots);
+    }
+    printf("  empty blocks: %ld resident, %ld released\n", occupancy.empty_blocks, occupancy.released_blocks);
+    printf("  large objects: %ld, %ld bytes in %ld mapped bytes\n", occupancy.large_objects,
+            occupancy.large_bytes, occupancy.large_mapped_bytes);
+}
+
+}
+}
@@ -0,0 +1,55 @@
+// Copyright (c) 2014 Dropbox, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PYSTON_GC_TELEMETRY_H
+#define PYSTON_GC_TELEMETRY_H
+
+#include "core/types.h"
+
+namespace pyston {
+namespace gc {
+
+// Everything we know about a single collection.
+struct CollectionEvent {
+    int number;
+    bool major;
+    // When the collection started, relative to the first one:
+    long start_us;
+    // The whole pause, and how much of it went to marking and to sweeping:
+    long pause_us, mark_us, sweep_us;
+    // Bytes allocated since the previous collection:
+    long allocated_bytes;
+    // Bytes marked, ie the live heap for a major collection, or the bytes promoted by a minor one:
+    long marked_bytes;
+    // Bytes freed by sweeping.  Sweeping is lazy, so this is only known once the next
+    // collection starts (and the event only gets logged then).
+    long freed_bytes;
+};
+
+void recordCollection(const CollectionEvent &event);
+// Called at the start of a collection with the bytes freed since the previous one.
+void recordBytesFreed(long freed_bytes);
+
+// The number and total size of the objects of each kind that a major collection found to be live,
+// indexed by kind_id - the first kind id.
+void recordLiveKinds(const AllocationKind* const* kinds, const long* counts, const long* bytes, int num_kinds);
+
+// Prints a summary of the collections so far (pause percentiles, the mark/sweep split, live objects
+// by kind and how fragmented each size class is), for -s.
+void dumpTelemetry();
+
+}
+}
+
+#endif
@@ -36,6 +36,10 @@
 #include "codegen/llvm_interpreter.h"
 #include "codegen/parser.h"
 
+#include "gc/telemetry.h"
+
+#include "runtime/heap_profiler.h"
+
 
 #ifndef GITREV
 #error
@@ -54,7 +58,7 @@ int main(int argc, char** argv) {
     bool force_repl = false;
     bool repl = true;
     bool stats = false;
-    while ((code = getopt(argc, argv, "+Oqcdibpjtrsvn")) != -1) {
+    while ((code = getopt(argc, argv, "+OqcdibpjtrsvnHIBg:G:M:E:T:A:a:k:C:P:L:")) != -1) {
         if (code == 'O')
             FORCE_OPTIMIZE = true;
         else if (code == 't')
@@ -81,6 +85,58 @@ int main(int argc, char** argv) {
             stats = true;
         } else if (code == 'r') {
             USE_STRIPPED_STDLIB = true;
+        } else if (code == 'H') {
+            GC_HUGE_PAGES = true;
+        } else if (code == 'I') {
+            TAGGED_INTS = true;
+        } else if (code == 'B') {
+            BACKGROUND_COMPILE = true;
+        } else if (code == 'g') {
+            GC_MARK_THREADS = atoi(optarg);
+            if (GC_MARK_THREADS < 1) {
+                fprintf(stderr, "Error: -g takes a positive number of threads\n");
+                exit(1);
+            }
+        } else if (code == 'G') {
+            GC_GROWTH_PERCENT = atoi(optarg);
+            if (GC_GROWTH_PERCENT < 1) {
+                fprintf(stderr, "Error: -G takes a positive percentage\n");
+                exit(1);
+            }
+        } else if (code == 'M') {
+            GC_SOFT_LIMIT_MB = atoi(optarg);
+            if (GC_SOFT_LIMIT_MB < 0) {
+                fprintf(stderr, "Error: -M takes a size in megabytes, or 0 for no limit\n");
+                exit(1);
+            }
+        } else if (code == 'E') {
+            GC_EMPTY_BLOCKS_MB = atoi(optarg);
+            if (GC_EMPTY_BLOCKS_MB < 0) {
+                fprintf(stderr, "Error: -E takes a size in megabytes\n");
+                exit(1);
+            }
+        } else if (code == 'T') {
+            GC_EVENT_LOG = optarg;
+        } else if (code == 'A') {
+            HEAP_PROFILE_FILE = optarg;
+        } else if (code == 'a') {
+            HEAP_PROFILE_RATE = atoi(optarg);
+            if (HEAP_PROFILE_RATE < 1) {
+                fprintf(stderr, "Error: -a takes a positive number of bytes\n");
+                exit(1);
+            }
+        } else if (code == 'k') {
+            if (sscanf(optarg, "%d:%d", &SMALL_INT_CACHE_MIN, &SMALL_INT_CACHE_MAX) != 2
+                    || SMALL_INT_CACHE_MIN > SMALL_INT_CACHE_MAX) {
+                fprintf(stderr, "Error: -k takes a range of ints, like -5:1024\n");
+                exit(1);
+            }
+        } else if (code == 'C') {
+            OBJECT_CACHE_DIR = optarg;
+        } else if (code == 'P') {
+            TIERING_POLICY = optarg;
+        } else if (code == 'L') {
+            TIERING_LOG = optarg;
         } else if (code == '?')
             abort();
     }
@@ -103,6 +159,9 @@ int main(int argc, char** argv) {
         initCodegen();
     }
 
+    if (HEAP_PROFILE_FILE)
+        startHeapProfiler(HEAP_PROFILE_RATE);
+
     BoxedModule* main = createMainModule(fn);
 
     _t.split("to run");
@@ -229,6 +288,10 @@ int main(int argc, char** argv) {
 
     if (VERBOSITY() >= 1 || stats)
         Stats::dump();
+    if (stats)
+        gc::dumpTelemetry();
+    if (HEAP_PROFILE_FILE)
+        dumpHeapProfile(HEAP_PROFILE_FILE);
 
     return rtncode;
 }
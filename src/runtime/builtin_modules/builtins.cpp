@@ -36,7 +36,7 @@ extern "C" Box* trap() {
 
 extern "C" Box* abs_(Box* x) {
     if (x->cls == int_cls) {
-        i64 n = static_cast<BoxedInt*>(x)->n;
+        i64 n = intValue(x);
         return boxInt(n >= 0 ? n : -n);
     } else if (x->cls == float_cls) {
         double d = static_cast<BoxedFloat*>(x)->d;
@@ -94,7 +94,7 @@ extern "C" Box* chr(Box* arg) {
         fprintf(stderr, "TypeError: coercing to Unicode: need string of buffer, %s found\n", getTypeName(arg)->c_str());
         raiseExc();
     }
-    i64 n = static_cast<BoxedInt*>(arg)->n;
+    i64 n = intValue(arg);
     RELEASE_ASSERT(n >= 0 && n < 256, "");
 
     return boxString(std::string(1, (char)n));
@@ -104,7 +104,7 @@ Box* range1(Box* end) {
     RELEASE_ASSERT(end->cls == int_cls, "%s", getTypeName(end)->c_str());
 
     BoxedList *rtn = new BoxedList();
-    i64 iend = static_cast<BoxedInt*>(end)->n;
+    i64 iend = intValue(end);
     for (i64 i = 0; i < iend; i++) {
         Box *bi = boxInt(i);
         listAppendInternal(rtn, bi);
@@ -117,8 +117,8 @@ Box* range2(Box* start, Box* end) {
     RELEASE_ASSERT(end->cls == int_cls, "%s", getTypeName(end)->c_str());
 
     BoxedList *rtn = new BoxedList();
-    i64 istart = static_cast<BoxedInt*>(start)->n;
-    i64 iend = static_cast<BoxedInt*>(end)->n;
+    i64 istart = intValue(start);
+    i64 iend = intValue(end);
 
     for (i64 i = istart; i < iend; i++) {
         Box *bi = boxInt(i);
@@ -133,9 +133,9 @@ Box* range3(Box* start, Box* end, Box* step) {
     RELEASE_ASSERT(step->cls == int_cls, "%s", getTypeName(step)->c_str());
 
     BoxedList *rtn = new BoxedList();
-    i64 istart = static_cast<BoxedInt*>(start)->n;
-    i64 iend = static_cast<BoxedInt*>(end)->n;
-    i64 istep = static_cast<BoxedInt*>(step)->n;
+    i64 istart = intValue(start);
+    i64 iend = intValue(end);
+    i64 istep = intValue(step);
     RELEASE_ASSERT(istep != 0, "step can't be 0");
 
     if (istep > 0) {
@@ -33,7 +33,7 @@ static double _extractFloat(Box* b) {
     }
 
     if (b->cls == int_cls)
-        return static_cast<BoxedInt*>(b)->n;
+        return intValue(b);
     else
         return static_cast<BoxedFloat*>(b)->d;
 }
@@ -21,6 +21,8 @@
 #include "runtime/types.h"
 #include "runtime/util.h"
 
+#include "gc/collector.h"
+
 namespace pyston {
 
 Box* dictRepr(BoxedDict* self) {
@@ -77,6 +79,8 @@ Box* dictKeys(BoxedDict* self) {
 
 Box* dictGetitem(BoxedDict* self, Box* k) {
     Box* &pos = self->d[k];
+    // operator[] will have inserted k if it wasn't already there:
+    gc::writeBarrier(self);
 
     if (pos == NULL) {
         BoxedString *s = repr(k);
@@ -97,6 +101,7 @@ Box* dictSetitem(BoxedDict* self, Box* k, Box* v) {
     } else {
         pos = v;
     }
+    gc::writeBarrier(self);
 
     return None;
 }
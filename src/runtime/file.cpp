@@ -70,7 +70,7 @@ Box* fileRead2(BoxedFile* self, Box* size) {
         fprintf(stderr, "TypeError: an integer is required\n");
         raiseExc();
     }
-    return _fileRead(self, static_cast<BoxedInt*>(size)->n);
+    return _fileRead(self, intValue(size));
 }
 
 Box* fileWrite(BoxedFile* self, Box* val) {
@@ -140,7 +140,12 @@ Box* fileExit(BoxedFile* self, Box* exc_type, Box* exc_val, Box** args) {
     return fileClose(self);
 }
 
+// This is also file_flavor's finalizer.
 void file_dtor(BoxedFile* t) {
+    if (!t->closed) {
+        fclose(t->f);
+        t->closed = true;
+    }
 }
 
 Box* fileNew2(BoxedClass *cls, Box* s) {
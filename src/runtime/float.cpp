@@ -68,7 +68,7 @@ extern "C" Box* floatAdd(BoxedFloat* lhs, Box *rhs) {
     //printf("floatAdd %p %p\n", lhs, rhs);
     if (rhs->cls == int_cls) {
         BoxedInt* rhs_int = static_cast<BoxedInt*>(rhs);
-        return boxFloat(lhs->d + rhs_int->n);
+        return boxFloat(lhs->d + intValue(rhs_int));
     } else if (rhs->cls == float_cls) {
         BoxedFloat *rhs_float = static_cast<BoxedFloat*>(rhs);
         return boxFloat(lhs->d + rhs_float->d);
@@ -81,11 +81,11 @@ extern "C" Box* floatDiv(BoxedFloat* lhs, Box *rhs) {
     assert(lhs->cls == float_cls);
     if (rhs->cls == int_cls) {
         BoxedInt *rhs_int = static_cast<BoxedInt*>(rhs);
-        if (rhs_int->n == 0) {
+        if (intValue(rhs_int) == 0) {
             fprintf(stderr, "float divide by zero\n");
             raiseExc();
         }
-        return boxFloat(lhs->d / rhs_int->n);
+        return boxFloat(lhs->d / intValue(rhs_int));
     } else if (rhs->cls == float_cls) {
         BoxedFloat *rhs_float = static_cast<BoxedFloat*>(rhs);
         if (rhs_float->d == 0) {
@@ -107,7 +107,7 @@ extern "C" Box* floatRDiv(BoxedFloat* lhs, Box *rhs) {
 
     if (rhs->cls == int_cls) {
         BoxedInt *rhs_int = static_cast<BoxedInt*>(rhs);
-        return boxFloat(rhs_int->n / lhs->d);
+        return boxFloat(intValue(rhs_int) / lhs->d);
     } else if (rhs->cls == float_cls) {
         BoxedFloat *rhs_float = static_cast<BoxedFloat*>(rhs);
         return boxFloat(rhs_float->d / lhs->d);
@@ -123,7 +123,7 @@ extern "C" Box* floatEq(BoxedFloat* lhs, Box *rhs) {
         return boxBool(lhs->d == rhs_float->d);
     } else if (rhs->cls == int_cls) {
         BoxedInt *rhs_int = static_cast<BoxedInt*>(rhs);
-        return boxBool(lhs->d == rhs_int->n);
+        return boxBool(lhs->d == intValue(rhs_int));
     } else {
         return NotImplemented;
     }
@@ -149,7 +149,7 @@ extern "C" Box* floatNe(BoxedFloat* lhs, Box *rhs) {
         return boxBool(lhs->d != rhs_float->d);
     } else if (rhs->cls == int_cls) {
         BoxedInt *rhs_int = static_cast<BoxedInt*>(rhs);
-        return boxBool(lhs->d != rhs_int->n);
+        return boxBool(lhs->d != intValue(rhs_int));
     } else {
         return NotImplemented;
     }
@@ -162,7 +162,7 @@ extern "C" Box* floatLt(BoxedFloat* lhs, Box *rhs) {
         return boxBool(lhs->d < rhs_float->d);
     } else if (rhs->cls == int_cls) {
         BoxedInt *rhs_int = static_cast<BoxedInt*>(rhs);
-        return boxBool(lhs->d < rhs_int->n);
+        return boxBool(lhs->d < intValue(rhs_int));
     } else {
         return NotImplemented;
     }
@@ -175,7 +175,7 @@ extern "C" Box* floatLe(BoxedFloat* lhs, Box *rhs) {
         return boxBool(lhs->d <= rhs_float->d);
     } else if (rhs->cls == int_cls) {
         BoxedInt *rhs_int = static_cast<BoxedInt*>(rhs);
-        return boxBool(lhs->d <= rhs_int->n);
+        return boxBool(lhs->d <= intValue(rhs_int));
     } else {
         return NotImplemented;
     }
@@ -188,7 +188,7 @@ extern "C" Box* floatGt(BoxedFloat* lhs, Box *rhs) {
         return boxBool(lhs->d > rhs_float->d);
     } else if (rhs->cls == int_cls) {
         BoxedInt *rhs_int = static_cast<BoxedInt*>(rhs);
-        return boxBool(lhs->d > rhs_int->n);
+        return boxBool(lhs->d > intValue(rhs_int));
     } else {
         return NotImplemented;
     }
@@ -201,7 +201,7 @@ extern "C" Box* floatGe(BoxedFloat* lhs, Box *rhs) {
         return boxBool(lhs->d >= rhs_float->d);
     } else if (rhs->cls == int_cls) {
         BoxedInt *rhs_int = static_cast<BoxedInt*>(rhs);
-        return boxBool(lhs->d >= rhs_int->n);
+        return boxBool(lhs->d >= intValue(rhs_int));
     } else {
         return NotImplemented;
     }
@@ -225,7 +225,7 @@ extern "C" Box* floatMod(BoxedFloat* lhs, Box *rhs) {
     double drhs;
     if (rhs->cls == int_cls) {
         BoxedInt *rhs_int = static_cast<BoxedInt*>(rhs);
-        drhs = rhs_int->n;
+        drhs = intValue(rhs_int);
     } else if (rhs->cls == float_cls) {
         BoxedFloat *rhs_float = static_cast<BoxedFloat*>(rhs);
         drhs = rhs_float->d;
@@ -259,7 +259,7 @@ extern "C" Box* floatRMod(BoxedFloat* lhs, Box *rhs) {
     double drhs;
     if (rhs->cls == int_cls) {
         BoxedInt *rhs_int = static_cast<BoxedInt*>(rhs);
-        drhs = rhs_int->n;
+        drhs = intValue(rhs_int);
     } else if (rhs->cls == float_cls) {
         BoxedFloat *rhs_float = static_cast<BoxedFloat*>(rhs);
         drhs = rhs_float->d;
@@ -279,7 +279,7 @@ extern "C" Box* floatPow(BoxedFloat* lhs, Box *rhs) {
     assert(lhs->cls == float_cls);
     if (rhs->cls == int_cls) {
         BoxedInt* rhs_int = static_cast<BoxedInt*>(rhs);
-        return boxFloat(pow(lhs->d, rhs_int->n));
+        return boxFloat(pow(lhs->d, intValue(rhs_int)));
     } else if (rhs->cls == float_cls) {
         BoxedFloat *rhs_float = static_cast<BoxedFloat*>(rhs);
         return boxFloat(pow(lhs->d, rhs_float->d));
@@ -299,7 +299,7 @@ extern "C" Box* floatMul(BoxedFloat* lhs, Box *rhs) {
     assert(lhs->cls == float_cls);
     if (rhs->cls == int_cls) {
         BoxedInt *rhs_int = static_cast<BoxedInt*>(rhs);
-        return boxFloat(lhs->d * rhs_int->n);
+        return boxFloat(lhs->d * intValue(rhs_int));
     } else if (rhs->cls == float_cls) {
         BoxedFloat *rhs_float = static_cast<BoxedFloat*>(rhs);
         return boxFloat(lhs->d * rhs_float->d);
@@ -319,7 +319,7 @@ extern "C" Box* floatSub(BoxedFloat* lhs, Box *rhs) {
     assert(lhs->cls == float_cls);
     if (rhs->cls == int_cls) {
         BoxedInt* rhs_int = static_cast<BoxedInt*>(rhs);
-        return boxFloat(lhs->d - rhs_int->n);
+        return boxFloat(lhs->d - intValue(rhs_int));
     } else if (rhs->cls == float_cls) {
         BoxedFloat *rhs_float = static_cast<BoxedFloat*>(rhs);
         return boxFloat(lhs->d - rhs_float->d);
@@ -332,7 +332,7 @@ extern "C" Box* floatRSub(BoxedFloat* lhs, Box *rhs) {
     assert(lhs->cls == float_cls);
     if (rhs->cls == int_cls) {
         BoxedInt* rhs_int = static_cast<BoxedInt*>(rhs);
-        return boxFloat(rhs_int->n - lhs->d);
+        return boxFloat(intValue(rhs_int) - lhs->d);
     } else if (rhs->cls == float_cls) {
         BoxedFloat *rhs_float = static_cast<BoxedFloat*>(rhs);
         return boxFloat(rhs_float->d - lhs->d);
@@ -480,7 +480,17 @@ static void _addFunc(const char* name, void* float_func, void* boxed_func) {
     float_cls->giveAttr(name, new BoxedFunction(cl));
 }
 
+extern "C" Box* boxUnrecycledFloat(double d) {
+    static StatCounter sc_misses("gc_recycled_allocs_missed");
+    sc_misses.log();
+    return new BoxedFloat(d);
+}
+
 void setupFloat() {
+    // Floats are the most common short-lived objects that don't have a cache like ints do, so they
+    // get reused straight out of the sweeper:
+    gc::global_heap.setRecycledKind(&float_flavor);
+
     float_cls->giveAttr("__name__", boxStrConstant("float"));
 
     _addFunc("__add__", (void*)floatAddFloat, (void*)floatAdd);
@@ -24,7 +24,12 @@ namespace pyston {
 class Box;
 
 void gc_teardown();
-extern "C" void* rt_alloc(size_t size);
+// rt_alloc gets inlined into the rest of the stdlib, and from there into jitted code;
+// for a constant size, that reduces to the thread cache's fast path.
+extern "C" void* rt_alloc(size_t size) ALWAYSINLINE;
+// Returns a dead object of the heap's recycled kind (see Heap::setRecycledKind), which has to be
+// completely reinitialized, or NULL if there aren't any.  It gets sampled like rt_alloc would.
+extern "C" void* rt_alloc_recycled(size_t size) ALWAYSINLINE;
 extern "C" void* rt_realloc(void* ptr, size_t new_size);
 extern "C" void rt_free(void* ptr);
 }
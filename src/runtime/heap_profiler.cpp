@@ -0,0 +1,247 @@
+// Copyright (c) 2014 Dropbox, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cassert>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define UNW_LOCAL_ONLY
+#include <libunwind.h>
+
+#include "core/common.h"
+#include "core/options.h"
+#include "core/stats.h"
+#include "core/types.h"
+
+#include "codegen/codegen.h"
+
+#include "gc/collector.h"
+#include "gc/heap.h"
+
+#include "runtime/heap_profiler.h"
+#include "runtime/objmodel.h"
+
+namespace pyston {
+
+long heap_profile_bytes_until_sample = LONG_MAX;
+bool heap_profile_enabled = false;
+
+static long sample_rate;
+
+#define MAX_SAMPLE_FRAMES 32
+
+namespace {
+// The objects that got sampled at a particular allocation site, as a particular type.
+struct SiteTotals {
+    long alloc_count = 0, alloc_bytes = 0;
+    // As of the end of the last collection:
+    long live_count = 0, live_bytes = 0;
+};
+
+struct Sample {
+    size_t size;
+    int stack_id;
+    // NULL until the object's type has been looked up:
+    SiteTotals* site;
+};
+}
+
+static std::map<std::vector<void*>, int> stack_ids;
+static std::vector<const std::vector<void*>*> stacks;
+// Keyed by (stack id, type name):
+static std::map<std::pair<int, std::string>, SiteTotals> sites;
+// The sampled objects that haven't been freed yet:
+static std::unordered_map<void*, Sample> samples;
+
+// The sampling is randomized (the distance between samples is exponentially distributed, with a
+// mean of sample_rate bytes), so that it doesn't alias with allocation patterns; this is also
+// what pprof assumes when it scales the samples back up.
+static long nextSampleDistance() {
+    static uint64_t state = 88172645463325252UL;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    double u = ((state >> 11) + 1) / 9007199254740993.0;
+    return (long)(-log(u) * sample_rate) + 1;
+}
+
+static std::string typeNameOf(void* p) {
+    GCObjectHeader* header = gc::headerFromObject(p);
+    const AllocationKind* kind = gc::getKind(header->kind_id);
+    if (!kind)
+        return "<uninitialized>";
+
+    if (gc::isFlavorKind(header->kind_id)) {
+        Box* b = static_cast<Box*>(p);
+        if (b->cls && gc::global_heap.getAllocationFromInteriorPointer(b->cls) == b->cls)
+            return *getTypeName(b);
+        return "<uninitialized>";
+    }
+
+    // Not a Box, so name it after its kind:
+    std::string name = g.func_addr_registry.getFuncNameAtAddress((void*)kind, true);
+    return "[" + name + "]";
+}
+
+static void resolveSite(void* p, Sample &s) {
+    if (s.site)
+        return;
+
+    SiteTotals &site = sites[std::make_pair(s.stack_id, typeNameOf(p))];
+    site.alloc_count++;
+    site.alloc_bytes += s.size;
+    s.site = &site;
+}
+
+// Drops the samples that didn't survive the collection, and recomputes what's live.
+static void heapProfilePostMark() {
+    for (auto &p : sites) {
+        p.second.live_count = 0;
+        p.second.live_bytes = 0;
+    }
+
+    for (auto it = samples.begin(); it != samples.end();) {
+        resolveSite(it->first, it->second);
+
+        if (!gc::isMarked(gc::headerFromObject(it->first))) {
+            it = samples.erase(it);
+            continue;
+        }
+
+        it->second.site->live_count++;
+        it->second.site->live_bytes += it->second.size;
+        ++it;
+    }
+}
+
+void startHeapProfiler(long rate) {
+    assert(rate > 0);
+    sample_rate = rate;
+    heap_profile_enabled = true;
+    heap_profile_bytes_until_sample = nextSampleDistance();
+    gc::registerPostMarkHook(heapProfilePostMark);
+}
+
+extern "C" void heapProfileSample(void* ptr, size_t size) {
+    if (!heap_profile_enabled) {
+        heap_profile_bytes_until_sample = LONG_MAX;
+        return;
+    }
+
+    static StatCounter sc_samples("heap_profile_samples");
+    sc_samples.log();
+
+    // The allocation could have used up more than one sampling interval, but it only gets sampled
+    // once; pprof accounts for that using the object size.
+    while (heap_profile_bytes_until_sample < 0)
+        heap_profile_bytes_until_sample += nextSampleDistance();
+
+    std::vector<void*> stack;
+    unw_cursor_t cursor;
+    unw_context_t uc;
+    unw_word_t ip;
+
+    unw_getcontext(&uc);
+    unw_init_local(&cursor, &uc);
+    // The first step gets us to the caller of this function, which is where rt_alloc got inlined:
+    while (unw_step(&cursor) > 0 && stack.size() < MAX_SAMPLE_FRAMES) {
+        unw_get_reg(&cursor, UNW_REG_IP, &ip);
+        stack.push_back((void*)ip);
+    }
+
+    auto it = stack_ids.find(stack);
+    if (it == stack_ids.end()) {
+        it = stack_ids.insert(std::make_pair(stack, (int)stacks.size())).first;
+        stacks.push_back(&it->first);
+    }
+
+    samples[ptr] = Sample{size, it->second, NULL};
+}
+
+extern "C" void heapProfileFree(void* ptr) {
+    auto it = samples.find(ptr);
+    if (it == samples.end())
+        return;
+
+    resolveSite(ptr, it->second);
+    samples.erase(it);
+}
+
+void dumpHeapProfile(const char* fn) {
+    FILE* f = fopen(fn, "w");
+    RELEASE_ASSERT(f, "couldn't open %s", fn);
+
+    // Whatever has been allocated since the last collection still needs its type looked up:
+    for (auto &p : samples) {
+        resolveSite(p.first, p.second);
+    }
+
+    // Each type gets a fake leaf frame, so that pprof shows what was allocated as well as where.
+    // They get addresses that can't be real code addresses.
+    std::map<std::string, uintptr_t> type_addrs;
+    for (auto &p : sites) {
+        if (!type_addrs.count(p.first.second))
+            type_addrs[p.first.second] = 0x10 * (type_addrs.size() + 1);
+    }
+
+    // Symbolize everything here, since pprof won't be able to find the jitted functions.
+    // pprof looks up return addresses minus one, so those get entries too.
+    fprintf(f, "--- symbol\n");
+    fprintf(f, "binary=pyston\n");
+    for (auto &p : type_addrs) {
+        fprintf(f, "0x%016lx alloc:%s\n", p.second, p.first.c_str());
+    }
+    std::unordered_map<void*, bool> symbolized;
+    for (auto stack : stacks) {
+        for (void* ip : *stack) {
+            if (symbolized[ip])
+                continue;
+            symbolized[ip] = true;
+            std::string name = g.func_addr_registry.getFuncNameContainingAddress((char*)ip - 1, true);
+            fprintf(f, "0x%016lx %s\n", (uintptr_t)ip, name.c_str());
+            fprintf(f, "0x%016lx %s\n", (uintptr_t)ip - 1, name.c_str());
+        }
+    }
+    fprintf(f, "---\n");
+    fprintf(f, "--- heap\n");
+
+    long total_live = 0, total_live_bytes = 0, total_alloc = 0, total_alloc_bytes = 0;
+    for (auto &p : sites) {
+        total_live += p.second.live_count;
+        total_live_bytes += p.second.live_bytes;
+        total_alloc += p.second.alloc_count;
+        total_alloc_bytes += p.second.alloc_bytes;
+    }
+    fprintf(f, "heap profile: %ld: %ld [%ld: %ld] @ heap_v2/%ld\n", total_live, total_live_bytes, total_alloc,
+            total_alloc_bytes, sample_rate);
+
+    for (auto &p : sites) {
+        const SiteTotals &site = p.second;
+        fprintf(f, "%ld: %ld [%ld: %ld] @ 0x%016lx", site.live_count, site.live_bytes, site.alloc_count,
+                site.alloc_bytes, type_addrs[p.first.second]);
+        for (void* ip : *stacks[p.first.first]) {
+            fprintf(f, " 0x%016lx", (uintptr_t)ip);
+        }
+        fprintf(f, "\n");
+    }
+
+    fclose(f);
+}
+
+}
@@ -0,0 +1,45 @@
+// Copyright (c) 2014 Dropbox, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PYSTON_RUNTIME_HEAPPROFILER_H
+#define PYSTON_RUNTIME_HEAPPROFILER_H
+
+#include <cstddef>
+
+#include "core/common.h"
+
+namespace pyston {
+
+// Sampling heap profiler: roughly every HEAP_PROFILE_RATE bytes, rt_alloc records the call
+// stack of the allocation.  Once the object gets looked at (at the next collection), the
+// sample also gets attributed to the object's class, and every collection updates which
+// of the sampled objects are still alive.
+
+// How many more bytes can be allocated before the next sample gets taken.  This gets
+// decremented inline by rt_alloc; it stays huge if the profiler isn't running.
+extern "C" long heap_profile_bytes_until_sample;
+extern "C" bool heap_profile_enabled;
+
+void startHeapProfiler(long sample_rate);
+extern "C" void heapProfileSample(void* ptr, size_t size) NOINLINE;
+// Has to be called when a sampled object gets explicitly freed, since its slot could get reused.
+extern "C" void heapProfileFree(void* ptr);
+// Writes the profile in the (symbolized) legacy pprof heap format: in-use counts are the sampled
+// objects that were alive at the end of the last collection, and allocation counts are everything
+// that has been sampled.
+void dumpHeapProfile(const char* fn);
+
+}
+
+#endif
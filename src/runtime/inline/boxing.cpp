@@ -13,6 +13,8 @@
 // limitations under the License.
 
 
+#include "core/options.h"
+
 #include "runtime/gc_runtime.h"
 #include "runtime/int.h"
 #include "runtime/objmodel.h"
@@ -50,14 +52,16 @@ extern "C" double unboxFloat(Box *b) {
 
 i64 unboxInt(Box *b) {
     ASSERT(b->cls == int_cls, "%s", getTypeName(b)->c_str());
-    return ((BoxedInt*)b)->n;
+    return intValue(b);
 }
 
 Box* boxInt(int64_t n) {
-    if (0 <= n && n < NUM_INTERNED_INTS) {
-        return interned_ints[n];
+    if (TAGGED_INTS && MIN_TAGGED_INT <= n && n <= MAX_TAGGED_INT) {
+        return tagInt(n);
     }
-    return new BoxedInt(n);
+    if (SMALL_INT_CACHE_MIN <= n && n <= SMALL_INT_CACHE_MAX)
+        return small_ints[n];
+    return boxUncachedInt(n);
 }
 
 //BoxedInt::BoxedInt(int64_t n) : Box(int_cls), n(n) {}
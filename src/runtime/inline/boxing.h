@@ -15,6 +15,8 @@
 #ifndef PYSTON_RUNTIME_INLINE_BOXING_H
 #define PYSTON_RUNTIME_INLINE_BOXING_H
 
+#include <new>
+
 #include "runtime/gc_runtime.h"
 #include "runtime/int.h"
 #include "runtime/objmodel.h"
@@ -24,7 +26,11 @@ namespace pyston {
 
 extern "C" inline Box* boxFloat(double d) __attribute__((visibility("default")));
 extern "C" inline Box* boxFloat(double d) {
-    return new BoxedFloat(d);
+    // Floats get recycled by the sweeper (see setupFloat):
+    void* p = rt_alloc_recycled(sizeof(BoxedFloat));
+    if (p)
+        return ::new (p) BoxedFloat(d);
+    return boxUnrecycledFloat(d);
 }
 
 extern "C" inline Box* boxBool(bool b) __attribute__((visibility("default")));
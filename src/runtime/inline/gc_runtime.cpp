@@ -20,6 +20,7 @@
 #include "core/types.h"
 
 #include "runtime/gc_runtime.h"
+#include "runtime/heap_profiler.h"
 #include "runtime/objmodel.h"
 #include "runtime/types.h"
 
@@ -45,6 +46,9 @@ void* rt_alloc(size_t size) {
     void* ptr = malloc(size);
 #endif
 
+    if (__builtin_expect((heap_profile_bytes_until_sample -= size) < 0, 0))
+        heapProfileSample(ptr, size);
+
 #ifndef NDEBUG
     //nallocs++;
 #endif
@@ -54,7 +58,20 @@ void* rt_alloc(size_t size) {
     return ptr;
 }
 
+void* rt_alloc_recycled(size_t size) {
+    void* ptr = gc::global_heap.allocRecycled();
+    if (!ptr)
+        return NULL;
+
+    if (__builtin_expect((heap_profile_bytes_until_sample -= size) < 0, 0))
+        heapProfileSample(ptr, size);
+    return ptr;
+}
+
 void* rt_realloc(void* ptr, size_t new_size) {
+    if (heap_profile_enabled)
+        heapProfileFree(ptr);
+
 #ifdef USE_CUSTOM_ALLOC
     void* rtn = gc::gc_realloc(ptr, new_size);
 #else
@@ -76,6 +93,9 @@ void rt_free(void* ptr) {
     getAlive()->erase(ptr);
 #endif
 
+    if (heap_profile_enabled)
+        heapProfileFree(ptr);
+
 #ifdef USE_CUSTOM_ALLOC
     gc::gc_free(ptr);
 #else
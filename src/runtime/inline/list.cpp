@@ -15,6 +15,8 @@
 #include "runtime/list.h"
 #include "runtime/gc_runtime.h"
 
+#include "gc/collector.h"
+
 namespace pyston {
 
 BoxedListIterator::BoxedListIterator(BoxedList* l) : Box(&list_iterator_flavor, list_iterator_cls), l(l), pos(0) {
@@ -65,6 +67,10 @@ void BoxedList::ensure(int space) {
         }
     }
     assert(capacity >= size + space);
+
+    // Callers fill in the new space without allocating anything in between, so running
+    // the write barrier here covers their stores as well as the new elts pointer.
+    gc::writeBarrier(this);
 }
 
 // TODO the inliner doesn't want to inline these; is there any point to having them in the inline section?
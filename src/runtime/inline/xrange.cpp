@@ -97,7 +97,7 @@ Box* xrange1(Box* cls, Box* stop) {
     assert(cls == xrange_cls);
     RELEASE_ASSERT(stop->cls == int_cls, "%s", getTypeName(stop)->c_str());
 
-    i64 istop = static_cast<BoxedInt*>(stop)->n;
+    i64 istop = intValue(stop);
     return new BoxedXrange(0, istop, 1);
 }
 
@@ -106,8 +106,8 @@ Box* xrange2(Box* cls, Box* start, Box* stop) {
     RELEASE_ASSERT(start->cls == int_cls, "%s", getTypeName(start)->c_str());
     RELEASE_ASSERT(stop->cls == int_cls, "%s", getTypeName(stop)->c_str());
 
-    i64 istart = static_cast<BoxedInt*>(start)->n;
-    i64 istop = static_cast<BoxedInt*>(stop)->n;
+    i64 istart = intValue(start);
+    i64 istop = intValue(stop);
     return new BoxedXrange(istart, istop, 1);
 }
 
@@ -119,9 +119,9 @@ Box* xrange3(Box* cls, Box* start, Box* stop, Box** args) {
     RELEASE_ASSERT(stop->cls == int_cls, "%s", getTypeName(stop)->c_str());
     RELEASE_ASSERT(step->cls == int_cls, "%s", getTypeName(step)->c_str());
 
-    i64 istart = static_cast<BoxedInt*>(start)->n;
-    i64 istop = static_cast<BoxedInt*>(stop)->n;
-    i64 istep = static_cast<BoxedInt*>(step)->n;
+    i64 istart = intValue(start);
+    i64 istop = intValue(stop);
+    i64 istep = intValue(step);
     RELEASE_ASSERT(istep != 0, "step can't be 0");
     return new BoxedXrange(istart, istop, istep);
 }
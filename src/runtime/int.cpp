@@ -12,7 +12,10 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <cstdio>
 #include <sstream>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "core/common.h"
 #include "core/options.h"
@@ -33,7 +36,14 @@
 
 namespace pyston {
 
-BoxedInt* interned_ints[NUM_INTERNED_INTS];
+BoxedInt** small_ints;
+
+// Only misses get counted, since a hit is just an array load:
+extern "C" Box* boxUncachedInt(i64 n) {
+    static StatCounter sc_misses("small_int_cache_misses");
+    sc_misses.log();
+    return new BoxedInt(n);
+}
 
 // Could add this to the others, but the inliner should be smart enough
 // that this isn't needed:
@@ -114,23 +124,23 @@ extern "C" i1 ge_i64_i64(i64 lhs, i64 rhs) {
 extern "C" Box* intAddInt(BoxedInt* lhs, BoxedInt *rhs) {
     assert(lhs->cls == int_cls);
     assert(rhs->cls == int_cls);
-    return boxInt(lhs->n + rhs->n);
+    return boxInt(intValue(lhs) + intValue(rhs));
 }
 
 extern "C" Box* intAddFloat(BoxedInt* lhs, BoxedFloat *rhs) {
     assert(lhs->cls == int_cls);
     assert(rhs->cls == float_cls);
-    return boxFloat(lhs->n + rhs->d);
+    return boxFloat(intValue(lhs) + rhs->d);
 }
 
 extern "C" Box* intAdd(BoxedInt* lhs, Box *rhs) {
     assert(lhs->cls == int_cls);
     if (rhs->cls == int_cls) {
         BoxedInt *rhs_int = static_cast<BoxedInt*>(rhs);
-        return boxInt(lhs->n + rhs_int->n);
+        return boxInt(intValue(lhs) + intValue(rhs_int));
     } else if (rhs->cls == float_cls) {
         BoxedFloat *rhs_float = static_cast<BoxedFloat*>(rhs);
-        return boxFloat(lhs->n + rhs_float->d);
+        return boxFloat(intValue(lhs) + rhs_float->d);
     } else {
         return NotImplemented;
     }
@@ -142,13 +152,13 @@ extern "C" Box* intAnd(BoxedInt* lhs, Box *rhs) {
         return NotImplemented;
     }
     BoxedInt *rhs_int = static_cast<BoxedInt*>(rhs);
-    return boxInt(lhs->n & rhs_int->n);
+    return boxInt(intValue(lhs) & intValue(rhs_int));
 }
 
 extern "C" Box* intDivInt(BoxedInt* lhs, BoxedInt *rhs) {
     assert(lhs->cls == int_cls);
     assert(rhs->cls == int_cls);
-    return boxInt(div_i64_i64(lhs->n, rhs->n));
+    return boxInt(div_i64_i64(intValue(lhs), intValue(rhs)));
 }
 
 extern "C" Box* intDivFloat(BoxedInt* lhs, BoxedFloat *rhs) {
@@ -159,7 +169,7 @@ extern "C" Box* intDivFloat(BoxedInt* lhs, BoxedFloat *rhs) {
         fprintf(stderr, "float divide by zero\n");
         raiseExc();
     }
-    return boxFloat(lhs->n / rhs->d);
+    return boxFloat(intValue(lhs) / rhs->d);
 }
 
 extern "C" Box* intDiv(BoxedInt* lhs, Box *rhs) {
@@ -179,7 +189,7 @@ extern "C" Box* intEq(BoxedInt* lhs, Box *rhs) {
         return NotImplemented;
     }
     BoxedInt *rhs_int = static_cast<BoxedInt*>(rhs);
-    return boxBool(lhs->n == rhs_int->n);
+    return boxBool(intValue(lhs) == intValue(rhs_int));
 }
 
 extern "C" Box* intNe(BoxedInt* lhs, Box *rhs) {
@@ -188,7 +198,7 @@ extern "C" Box* intNe(BoxedInt* lhs, Box *rhs) {
         return NotImplemented;
     }
     BoxedInt *rhs_int = static_cast<BoxedInt*>(rhs);
-    return boxBool(lhs->n != rhs_int->n);
+    return boxBool(intValue(lhs) != intValue(rhs_int));
 }
 
 extern "C" Box* intLt(BoxedInt* lhs, Box *rhs) {
@@ -197,7 +207,7 @@ extern "C" Box* intLt(BoxedInt* lhs, Box *rhs) {
         return NotImplemented;
     }
     BoxedInt *rhs_int = static_cast<BoxedInt*>(rhs);
-    return boxBool(lhs->n < rhs_int->n);
+    return boxBool(intValue(lhs) < intValue(rhs_int));
 }
 
 extern "C" Box* intLe(BoxedInt* lhs, Box *rhs) {
@@ -206,7 +216,7 @@ extern "C" Box* intLe(BoxedInt* lhs, Box *rhs) {
         return NotImplemented;
     }
     BoxedInt *rhs_int = static_cast<BoxedInt*>(rhs);
-    return boxBool(lhs->n <= rhs_int->n);
+    return boxBool(intValue(lhs) <= intValue(rhs_int));
 }
 
 extern "C" Box* intGt(BoxedInt* lhs, Box *rhs) {
@@ -215,7 +225,7 @@ extern "C" Box* intGt(BoxedInt* lhs, Box *rhs) {
         return NotImplemented;
     }
     BoxedInt *rhs_int = static_cast<BoxedInt*>(rhs);
-    return boxBool(lhs->n > rhs_int->n);
+    return boxBool(intValue(lhs) > intValue(rhs_int));
 }
 
 extern "C" Box* intGe(BoxedInt* lhs, Box *rhs) {
@@ -224,7 +234,7 @@ extern "C" Box* intGe(BoxedInt* lhs, Box *rhs) {
         return NotImplemented;
     }
     BoxedInt *rhs_int = static_cast<BoxedInt*>(rhs);
-    return boxBool(lhs->n >= rhs_int->n);
+    return boxBool(intValue(lhs) >= intValue(rhs_int));
 }
 
 extern "C" Box* intLShift(BoxedInt* lhs, Box *rhs) {
@@ -233,7 +243,7 @@ extern "C" Box* intLShift(BoxedInt* lhs, Box *rhs) {
         return NotImplemented;
     }
     BoxedInt *rhs_int = static_cast<BoxedInt*>(rhs);
-    return boxInt(lhs->n << rhs_int->n);
+    return boxInt(intValue(lhs) << intValue(rhs_int));
 }
 
 extern "C" Box* intMod(BoxedInt* lhs, Box *rhs) {
@@ -243,29 +253,29 @@ extern "C" Box* intMod(BoxedInt* lhs, Box *rhs) {
     }
     BoxedInt *rhs_int = static_cast<BoxedInt*>(rhs);
 
-    return boxInt(mod_i64_i64(lhs->n, rhs_int->n));
+    return boxInt(mod_i64_i64(intValue(lhs), intValue(rhs_int)));
 }
 
 extern "C" Box* intMulInt(BoxedInt* lhs, BoxedInt *rhs) {
     assert(lhs->cls == int_cls);
     assert(rhs->cls == int_cls);
-    return boxInt(lhs->n * rhs->n);
+    return boxInt(intValue(lhs) * intValue(rhs));
 }
 
 extern "C" Box* intMulFloat(BoxedInt* lhs, BoxedFloat *rhs) {
     assert(lhs->cls == int_cls);
     assert(rhs->cls == float_cls);
-    return boxFloat(lhs->n * rhs->d);
+    return boxFloat(intValue(lhs) * rhs->d);
 }
 
 extern "C" Box* intMul(BoxedInt* lhs, Box *rhs) {
     assert(lhs->cls == int_cls);
     if (rhs->cls == int_cls) {
         BoxedInt *rhs_int = static_cast<BoxedInt*>(rhs);
-        return boxInt(lhs->n * rhs_int->n);
+        return boxInt(intValue(lhs) * intValue(rhs_int));
     } else if (rhs->cls == float_cls) {
         BoxedFloat *rhs_float = static_cast<BoxedFloat*>(rhs);
-        return boxFloat(lhs->n * rhs_float->d);
+        return boxFloat(intValue(lhs) * rhs_float->d);
     } else {
         return NotImplemented;
     }
@@ -277,7 +287,7 @@ extern "C" Box* intPow(BoxedInt* lhs, Box *rhs) {
         return NotImplemented;
     }
     BoxedInt *rhs_int = static_cast<BoxedInt*>(rhs);
-    return boxInt(pow_i64_i64(lhs->n, rhs_int->n));
+    return boxInt(pow_i64_i64(intValue(lhs), intValue(rhs_int)));
 }
 
 extern "C" Box* intRShift(BoxedInt* lhs, Box *rhs) {
@@ -286,29 +296,29 @@ extern "C" Box* intRShift(BoxedInt* lhs, Box *rhs) {
         return NotImplemented;
     }
     BoxedInt *rhs_int = static_cast<BoxedInt*>(rhs);
-    return boxInt(lhs->n >> rhs_int->n);
+    return boxInt(intValue(lhs) >> intValue(rhs_int));
 }
 
 extern "C" Box* intSubInt(BoxedInt* lhs, BoxedInt *rhs) {
     assert(lhs->cls == int_cls);
     assert(rhs->cls == int_cls);
-    return boxInt(lhs->n - rhs->n);
+    return boxInt(intValue(lhs) - intValue(rhs));
 }
 
 extern "C" Box* intSubFloat(BoxedInt* lhs, BoxedFloat *rhs) {
     assert(lhs->cls == int_cls);
     assert(rhs->cls == float_cls);
-    return boxFloat(lhs->n - rhs->d);
+    return boxFloat(intValue(lhs) - rhs->d);
 }
 
 extern "C" Box* intSub(BoxedInt* lhs, Box *rhs) {
     assert(lhs->cls == int_cls);
     if (rhs->cls == int_cls) {
         BoxedInt *rhs_int = static_cast<BoxedInt*>(rhs);
-        return boxInt(lhs->n - rhs_int->n);
+        return boxInt(intValue(lhs) - intValue(rhs_int));
     } else if (rhs->cls == float_cls) {
         BoxedFloat *rhs_float = static_cast<BoxedFloat*>(rhs);
-        return boxFloat(lhs->n - rhs_float->d);
+        return boxFloat(intValue(lhs) - rhs_float->d);
     } else {
         return NotImplemented;
     }
@@ -316,7 +326,7 @@ extern "C" Box* intSub(BoxedInt* lhs, Box *rhs) {
 
 extern "C" Box* intInvert(BoxedInt* v) {
     assert(v->cls == int_cls);
-    return boxInt(~v->n);
+    return boxInt(~intValue(v));
 }
 
 extern "C" Box* intPos(BoxedInt* v) {
@@ -326,18 +336,18 @@ extern "C" Box* intPos(BoxedInt* v) {
 
 extern "C" Box* intNeg(BoxedInt* v) {
     assert(v->cls == int_cls);
-    return boxInt(-v->n);
+    return boxInt(-intValue(v));
 }
 
 extern "C" Box* intNonzero(BoxedInt* v) {
     assert(v->cls == int_cls);
-    return boxBool(v->n != 0);
+    return boxBool(intValue(v) != 0);
 }
 
 extern "C" BoxedString* intRepr(BoxedInt* v) {
     assert(v->cls == int_cls);
     char buf[80];
-    int len = snprintf(buf, 80, "%ld", v->n);
+    int len = snprintf(buf, 80, "%ld", intValue(v));
     return new BoxedString(std::string(buf, len));
 }
 
@@ -399,7 +409,47 @@ static void _addFunc(const char* name, void* int_func, void* float_func, void* b
     int_cls->giveAttr(name, new BoxedFunction(cl));
 }
 
+// The tagged int range (see isTaggedInt) has to read as int_cls everywhere.  Rather than filling
+// all of it, it gets filled by mapping the same small file over and over, so that it only takes
+// TAGGED_INT_CHUNK bytes of memory.
+#define TAGGED_INT_CHUNK (1 << 20)
+static void setupTaggedInts() {
+    FILE* f = tmpfile();
+    RELEASE_ASSERT(f, "couldn't create a file for the tagged ints");
+    int fd = fileno(f);
+    int r = ftruncate(fd, TAGGED_INT_CHUNK);
+    RELEASE_ASSERT(r == 0, "");
+
+    void* mrtn = mmap(NULL, TAGGED_INT_CHUNK, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    RELEASE_ASSERT(mrtn != MAP_FAILED, "");
+    BoxedClass** words = (BoxedClass**)mrtn;
+    for (int i = 0; i < TAGGED_INT_CHUNK / sizeof(BoxedClass*); i++) {
+        words[i] = int_cls;
+    }
+    munmap(mrtn, TAGGED_INT_CHUNK);
+
+    // The last int's cls field goes past the end of the range:
+    size_t size = TAGGED_INT_SIZE + sizeof(BoxedInt);
+    size = (size + TAGGED_INT_CHUNK - 1) / TAGGED_INT_CHUNK * TAGGED_INT_CHUNK;
+
+    // Reserve the whole range first, so that the fixed mappings can't clobber anything:
+    mrtn = mmap((void*)TAGGED_INT_START, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    RELEASE_ASSERT(mrtn == (void*)TAGGED_INT_START, "failed to reserve the tagged int range");
+    for (size_t offset = 0; offset < size; offset += TAGGED_INT_CHUNK) {
+        void* addr = (char*)TAGGED_INT_START + offset;
+        mrtn = mmap(addr, TAGGED_INT_CHUNK, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0);
+        RELEASE_ASSERT(mrtn == addr, "");
+    }
+
+    fclose(f);
+}
+
 void setupInt() {
+    // boxInt starts handing out tagged ints as soon as this is done, so it has to happen before
+    // anything creates an int:
+    if (TAGGED_INTS)
+        setupTaggedInts();
+
     int_cls->giveAttr("__name__", boxStrConstant("int"));
 
     //int_cls->giveAttr("__add__", new BoxedFunction(boxRTFunction((void*)intAdd, NULL, 2, false)));
@@ -440,10 +490,13 @@ void setupInt() {
 
     int_cls->freeze();
 
-    for (int i = 0; i < NUM_INTERNED_INTS; i++) {
-        interned_ints[i] = new BoxedInt(i);
-        gc::registerStaticRootObj(interned_ints[i]);
+    int num_small_ints = SMALL_INT_CACHE_MAX - SMALL_INT_CACHE_MIN + 1;
+    BoxedInt** cache = new BoxedInt*[num_small_ints];
+    for (int i = 0; i < num_small_ints; i++) {
+        cache[i] = new BoxedInt(SMALL_INT_CACHE_MIN + i);
+        gc::registerStaticRootObj(cache[i]);
     }
+    small_ints = cache - SMALL_INT_CACHE_MIN;
 }
 
 void teardownInt() {
@@ -62,8 +62,9 @@ extern "C" Box* intNew2(Box* cls, Box* val);
 extern "C" Box* intInit1(BoxedInt* self);
 extern "C" Box* intInit2(BoxedInt* self, Box* val);
 
-#define NUM_INTERNED_INTS 100
-extern BoxedInt* interned_ints[NUM_INTERNED_INTS];
+// boxInt returns preallocated ints for values in [SMALL_INT_CACHE_MIN, SMALL_INT_CACHE_MAX].
+// This gets offset so that it can be indexed by the value:
+extern BoxedInt** small_ints;
 
 }
 
@@ -67,7 +67,7 @@ extern "C" Box* listPop2(BoxedList* self, Box* idx) {
         raiseExc();
     }
 
-    int64_t n = static_cast<BoxedInt*>(idx)->n;
+    int64_t n = intValue(idx);
     if (n < 0)
         n = self->size + n;
 
@@ -114,7 +114,7 @@ Box* _listSlice(BoxedList *self, i64 start, i64 stop, i64 step) {
 extern "C" Box* listGetitem(BoxedList* self, Box* slice) {
     if (slice->cls == int_cls) {
         BoxedInt* islice = static_cast<BoxedInt*>(slice);
-        int64_t n = islice->n;
+        int64_t n = intValue(islice);
         if (n < 0)
             n = self->size + n;
 
@@ -139,7 +139,7 @@ extern "C" Box* listGetitem(BoxedList* self, Box* slice) {
 extern "C" Box* listSetitem(BoxedList* self, Box* slice, Box* v) {
     if (slice->cls == int_cls) {
         BoxedInt* islice = static_cast<BoxedInt*>(slice);
-        int64_t n = islice->n;
+        int64_t n = intValue(islice);
         if (n < 0)
             n = self->size + n;
 
@@ -150,6 +150,7 @@ extern "C" Box* listSetitem(BoxedList* self, Box* slice, Box* v) {
 
         Box* prev = self->elts->elts[n];
         self->elts->elts[n] = v;
+        gc::writeBarrier(self);
 
         return None;
     } else if (slice->cls == slice_cls) {
@@ -191,7 +192,7 @@ extern "C" Box* listInsert(BoxedList* self, Box* idx, Box* v) {
         raiseExc();
     }
 
-    int64_t n = static_cast<BoxedInt*>(idx)->n;
+    int64_t n = intValue(idx);
     if (n < 0)
         n = self->size + n;
 
@@ -218,7 +219,7 @@ Box* listMul(BoxedList* self, Box* rhs) {
         raiseExc();
     }
 
-    int n = static_cast<BoxedInt*>(rhs)->n;
+    int n = intValue(rhs);
     int s = self->size;
 
     BoxedList* rtn = new BoxedList();
@@ -28,6 +28,8 @@
 #include "asm_writing/rewriter.h"
 #include "asm_writing/rewriter2.h"
 
+#include "gc/collector.h"
+
 #include "runtime/gc_runtime.h"
 #include "runtime/importing.h"
 #include "runtime/objmodel.h"
@@ -151,6 +153,24 @@ struct CompareRewriteArgs {
 };
 
 Box* runtimeCallInternal(Box* obj, CallRewriteArgs *rewrite_args, int64_t nargs, Box* arg1, Box* arg2, Box* arg3, Box* *args);
+
+// The call site (return address) of the runtimeCall() or callattr() that we're currently under,
+// for resolveCLFuncForCallsite().  The calls that runtimeCallInternal() makes on the way (for
+// __init__, __call__ etc) share that call site's cache; it guards on the function anyway.
+static __thread void* cur_callsite = NULL;
+class CallsiteScope {
+    private:
+        void* prev_callsite;
+
+    public:
+        CallsiteScope(void* callsite) : prev_callsite(cur_callsite) {
+            cur_callsite = callsite;
+        }
+        ~CallsiteScope() {
+            cur_callsite = prev_callsite;
+        }
+};
+
 static Box* (*runtimeCallInternal0)(Box*, CallRewriteArgs*, int64_t) = (Box* (*)(Box*, CallRewriteArgs*, int64_t))runtimeCallInternal;
 static Box* (*runtimeCallInternal1)(Box*, CallRewriteArgs*, int64_t, Box*) = (Box* (*)(Box*, CallRewriteArgs*, int64_t, Box*))runtimeCallInternal;
 static Box* (*runtimeCallInternal2)(Box*, CallRewriteArgs*, int64_t, Box*, Box*) = (Box* (*)(Box*, CallRewriteArgs*, int64_t, Box*, Box*))runtimeCallInternal;
@@ -183,10 +203,13 @@ size_t PyHasher::operator() (Box* b) const {
         std::hash<std::string> H;
         return H(static_cast<BoxedString*>(b)->s);
     }
+    // Same as intHash, but without the call (or, for tagged ints, touching any memory):
+    if (b->cls == int_cls)
+        return intValue(b);
 
     BoxedInt *i = hash(b);
-    assert(sizeof(size_t) == sizeof(i->n));
-    size_t rtn = i->n;
+    static_assert(sizeof(size_t) == sizeof(i->n), "");
+    size_t rtn = intValue(i);
     return rtn;
 }
 
@@ -195,6 +218,9 @@ bool PyEq::operator() (Box* lhs, Box* rhs) const {
         if (lhs->cls == str_cls) {
             return static_cast<BoxedString*>(lhs)->s == static_cast<BoxedString*>(rhs)->s;
         }
+        if (lhs->cls == int_cls) {
+            return intValue(lhs) == intValue(rhs);
+        }
     }
 
     // TODO fix this
@@ -284,6 +310,7 @@ HiddenClass* HiddenClass::getOrMakeChild(const std::string& attr) {
 
     HiddenClass* rtn = new HiddenClass(this);
     this->children[attr] = rtn;
+    gc::writeBarrier(this);
     rtn->attr_offsets[attr] = attr_offsets.size();
     return rtn;
 }
@@ -389,21 +416,27 @@ void HCBox::setattr(const std::string& attr, Box* val, SetattrRewriteArgs *rewri
         assert(offset < numattrs);
         Box* prev = this->attr_list->attrs[offset];
         this->attr_list->attrs[offset] = val;
+        gc::writeBarrier(this);
 
         if (rewrite_args) {
             RewriterVar r_hattrs = rewrite_args->obj.getAttr(BOX_ATTRS_OFFSET, 1);
 
             r_hattrs.setAttr(offset * sizeof(Box*) + ATTRLIST_ATTRS_OFFSET, rewrite_args->attrval);
+
+            rewrite_args->obj.move(0);
+            rewrite_args->rewriter->call((void*)gc::gcWriteBarrier);
             rewrite_args->out_success = true;
         }
 
         if (rewrite_args2) {
 
-            RewriterVarUsage2 r_hattrs = rewrite_args2->obj.getAttr(BOX_ATTRS_OFFSET, RewriterVarUsage2::Kill, Location::any());
+            RewriterVarUsage2 r_hattrs = rewrite_args2->obj.getAttr(BOX_ATTRS_OFFSET, RewriterVarUsage2::NoKill, Location::any());
 
             r_hattrs.setAttr(offset * sizeof(Box*) + ATTRLIST_ATTRS_OFFSET, std::move(rewrite_args2->attrval));
             r_hattrs.setDoneUsing();
 
+            rewrite_args2->rewriter->call(false, (void*)gc::gcWriteBarrier, std::move(rewrite_args2->obj)).setDoneUsing();
+
             rewrite_args2->out_success = true;
         }
 
@@ -472,6 +505,9 @@ void HCBox::setattr(const std::string& attr, Box* val, SetattrRewriteArgs *rewri
         r_new_array.setAttr(numattrs * sizeof(Box*) + ATTRLIST_ATTRS_OFFSET, attrval);
         RewriterVar hcls = rewrite_args->rewriter->loadConst(1, (intptr_t)new_hcls);
         obj.setAttr(BOX_HCLS_OFFSET, hcls);
+
+        obj.move(0);
+        rewrite_args->rewriter->call((void*)gc::gcWriteBarrier);
         rewrite_args->out_success = true;
     }
     if (rewrite_args2) {
@@ -480,11 +516,13 @@ void HCBox::setattr(const std::string& attr, Box* val, SetattrRewriteArgs *rewri
 
         RewriterVarUsage2 r_hcls = rewrite_args2->rewriter->loadConst((intptr_t)new_hcls);
         rewrite_args2->obj.setAttr(BOX_HCLS_OFFSET, std::move(r_hcls));
-        rewrite_args2->obj.setDoneUsing();
+
+        rewrite_args2->rewriter->call(false, (void*)gc::gcWriteBarrier, std::move(rewrite_args2->obj)).setDoneUsing();
 
         rewrite_args2->out_success = true;
     }
     this->attr_list->attrs[numattrs] = val;
+    gc::writeBarrier(this);
 }
 
 static Box* _handleClsAttr(Box* obj, Box* attr) {
@@ -846,13 +884,19 @@ extern "C" bool nonzero(Box* obj) {
             // TODO should do:
             // test 	%rsi, %rsi
             // setne	%al
-            RewriterVar n = rewriter->getArg(0).getAttr(INT_N_OFFSET, 1);
+            RewriterVar n;
+            if (TAGGED_INTS) {
+                // The int might be tagged, in which case there's no n to load:
+                n = rewriter->call((void*)unboxInt);
+            } else {
+                n = rewriter->getArg(0).getAttr(INT_N_OFFSET, 1);
+            }
             n.toBool(-1);
             rewriter->commit();
         }
 
         BoxedInt *int_obj = static_cast<BoxedInt*>(obj);
-        return int_obj->n != 0;
+        return intValue(int_obj) != 0;
     } else if (obj->cls == float_cls) {
         return static_cast<BoxedFloat*>(obj)->d != 0;
     }
@@ -875,7 +919,7 @@ extern "C" bool nonzero(Box* obj) {
         return rtn;
     } else if (r->cls == int_cls) {
         BoxedInt* b = static_cast<BoxedInt*>(r);
-        bool rtn = b->n != 0;
+        bool rtn = intValue(b) != 0;
         return rtn;
     } else {
         fprintf(stderr, "TypeError: __nonzero__ should return bool or int, returned %s\n", getTypeName(r)->c_str());
@@ -1014,10 +1058,15 @@ extern "C" i64 unboxedLen(Box* obj) {
     }
 
     assert(lobj->cls == int_cls);
-    i64 rtn = lobj->n;
+    i64 rtn = intValue(lobj);
 
     if (rewriter.get()) {
-        RewriterVar rtn = r_boxed.getAttr(INT_N_OFFSET, -1);
+        if (TAGGED_INTS) {
+            r_boxed.move(0);
+            rewriter->call((void*)unboxInt);
+        } else {
+            RewriterVar rtn = r_boxed.getAttr(INT_N_OFFSET, -1);
+        }
         rewriter->commit();
     }
     return rtn;
@@ -1304,8 +1353,11 @@ extern "C" Box* callattr(Box* obj, std::string *attr, bool clsonly, int64_t narg
 
     assert(attr);
 
+    void* callsite = __builtin_extract_return_addr(__builtin_return_address(0));
+    CallsiteScope _callsite(callsite);
+
     int num_orig_args = 4 + std::min(4L, nargs);
-    std::unique_ptr<Rewriter> rewriter(Rewriter::createRewriter(__builtin_extract_return_addr(__builtin_return_address(0)), num_orig_args, 2, "callattr"));
+    std::unique_ptr<Rewriter> rewriter(Rewriter::createRewriter(callsite, num_orig_args, 2, "callattr"));
     Box* rtn;
 
     LookupScope scope = clsonly ? CLASS_ONLY : CLASS_OR_INST;
@@ -1379,7 +1431,7 @@ Box* runtimeCallInternal(Box* obj, CallRewriteArgs *rewrite_args, int64_t nargs,
     if (obj->cls == function_cls) {
         BoxedFunction *f = static_cast<BoxedFunction*>(obj);
 
-        CompiledFunction *cf = resolveCLFunc(f->f, nargs, arg1, arg2, arg3, args);
+        CompiledFunction *cf = resolveCLFuncForCallsite(cur_callsite, f->f, nargs, arg1, arg2, arg3, args);
 
         // typeCall (ie the base for constructors) is important enough that it knows
         // how to do rewrites, so lets cut directly to the internal function rather
@@ -1484,8 +1536,11 @@ extern "C" Box* runtimeCall(Box *obj, int64_t nargs, Box* arg1, Box* arg2, Box*
     static StatCounter slowpath_runtimecall("slowpath_runtimecall");
     slowpath_runtimecall.log();
 
+    void* callsite = __builtin_extract_return_addr(__builtin_return_address(0));
+    CallsiteScope _callsite(callsite);
+
     int num_orig_args = 2 + std::min(4L, nargs);
-    std::unique_ptr<Rewriter> rewriter(Rewriter::createRewriter(__builtin_extract_return_addr(__builtin_return_address(0)), num_orig_args, 2, "runtimeCall"));
+    std::unique_ptr<Rewriter> rewriter(Rewriter::createRewriter(callsite, num_orig_args, 2, "runtimeCall"));
     Box* rtn;
 
     if (rewriter.get()) {
@@ -43,8 +43,8 @@ extern "C" BoxedString* strAdd(BoxedString* lhs, Box* _rhs) {
 }
 
 extern "C" Box* strMod(BoxedString* lhs, Box* rhs) {
-    const std::vector<Box*> *elts;
-    std::vector<Box*> _elts;
+    const BoxedTuple::GCVector *elts;
+    BoxedTuple::GCVector _elts;
     if (rhs->cls == tuple_cls) {
         elts = &static_cast<BoxedTuple*>(rhs)->elts;
     } else {
@@ -130,7 +130,7 @@ extern "C" Box* strMod(BoxedString* lhs, Box* rhs) {
                     fmt << "ld";
 
                     char buf[20];
-                    snprintf(buf, 20, fmt.str().c_str(), static_cast<BoxedInt*>(b)->n);
+                    snprintf(buf, 20, fmt.str().c_str(), intValue(b));
                     os << std::string(buf);
                     break;
                 } else if (c == 'f') {
@@ -142,7 +142,7 @@ extern "C" Box* strMod(BoxedString* lhs, Box* rhs) {
                     if (b->cls == float_cls) {
                         d = static_cast<BoxedFloat*>(b)->d;
                     } else if (b->cls == int_cls) {
-                        d = static_cast<BoxedInt*>(b)->n;
+                        d = intValue(b);
                     } else {
                         RELEASE_ASSERT(0, "unsupported");
                     }
@@ -176,10 +176,10 @@ extern "C" BoxedString* strMul(BoxedString* lhs, BoxedInt* rhs) {
     assert(lhs->cls == str_cls);
     assert(rhs->cls == int_cls);
 
-    RELEASE_ASSERT(rhs->n >= 0, "");
+    RELEASE_ASSERT(intValue(rhs) >= 0, "");
 
     int sz = lhs->s.size();
-    int n = rhs->n;
+    int n = intValue(rhs);
     char* buf = new char[sz * n + 1];
     for (int i = 0; i < n; i++) {
         memcpy(buf + (sz * i), lhs->s.c_str(), sz);
@@ -326,7 +326,7 @@ Box* strJoin(BoxedString* self, Box* rhs) {
 extern "C" Box* strGetitem(BoxedString* self, Box* slice) {
     if (slice->cls == int_cls) {
         BoxedInt* islice = static_cast<BoxedInt*>(slice);
-        int64_t n = islice->n;
+        int64_t n = intValue(islice);
         int size = self->s.size();
         if (n < 0)
             n = size + n;
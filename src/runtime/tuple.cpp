@@ -32,7 +32,7 @@ extern "C" Box* createTuple(int64_t nelts, Box* *elts) {
 }
 
 void tuple_dtor(BoxedTuple* t) {
-    typedef std::vector<Box*> T;
+    typedef BoxedTuple::GCVector T;
     (&t->elts)->~T();
 }
 
@@ -42,7 +42,7 @@ Box* tupleGetitem(BoxedTuple *self, Box* slice) {
     i64 size = self->elts.size();
 
     if (slice->cls == int_cls) {
-        i64 n = static_cast<BoxedInt*>(slice)->n;
+        i64 n = intValue(slice);
 
         if (n < 0) n = size - n;
         if (n < 0 || n >= size) {
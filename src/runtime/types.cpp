@@ -117,7 +117,7 @@ extern "C" void listGCHandler(GCVisitor *v, void* p) {
     }
 
     static StatCounter sc("gc_listelts_visited");
-    sc.log(size);
+    v->logStat(sc, size);
 }
 
 // This probably belongs in tuple.cpp?
@@ -125,6 +125,9 @@ extern "C" void tupleGCHandler(GCVisitor *v, void* p) {
     boxGCHandler(v, p);
 
     BoxedTuple *t = (BoxedTuple*)p;
+    // The element storage doesn't scan itself (see StlStorageKind):
+    if (t->elts.capacity())
+        v->visit(ConservativeWrapper::fromPointer((void*)t->elts.data()));
     int size = t->elts.size();
     for (int i = 0; i < size; i++) {
         v->visit(t->elts[i]);
@@ -145,6 +148,36 @@ extern "C" void dictGCHandler(GCVisitor *v, void* p) {
     void **start = (void**)&d->d;
     void **end = start + (sizeof(d->d) / 8);
     v->visitPotentialRange(start, end);
+
+    // The map's storage gets allocated directly into the old generation (see
+    // StlCompatAllocator), so minor collections won't trace through it, and the
+    // nodes don't visit the entries themselves (see StlStorageKind); visit the
+    // entries directly.
+    for (auto p : d->d) {
+        v->visit(p.first);
+        // dictGetitem can leave behind NULL entries
+        if (p.second)
+            v->visit(p.second);
+    }
+}
+
+extern "C" void dictNodeGCHandler(GCVisitor *v, void* p) {
+#ifdef __GLIBCXX__
+    static_assert(std::is_same<decltype(std::__detail::_Hash_node_base::_M_nxt), std::__detail::_Hash_node_base*>::value
+            && sizeof(std::__detail::_Hash_node_base) == sizeof(void*), "unexpected libstdc++ hash node");
+
+    ConservativeWrapper *wrapper = static_cast<ConservativeWrapper*>(p);
+    assert(dict_node_layout_known);
+    assert(wrapper->gc_header.kind_id == dict_node_kind.kind_id);
+
+    // The first node is pointed to by the map itself, and each node points to the next one.
+    // Nodes point to each other's _Hash_node_base, which doesn't have to be at the start:
+    std::__detail::_Hash_node_base *node = (DictNode*)&wrapper->data[0];
+    if (node->_M_nxt)
+        v->visit(ConservativeWrapper::fromPointer(static_cast<DictNode*>(node->_M_nxt)));
+#else
+    RELEASE_ASSERT(0, "dict nodes only get their own kind with libstdc++");
+#endif
 }
 
 extern "C" void conservativeGCHandler(GCVisitor *v, void* p) {
@@ -175,12 +208,13 @@ extern "C" {
     const ObjectFlavor module_flavor(&hcBoxGCHandler, NULL);
     const ObjectFlavor dict_flavor(&dictGCHandler, NULL);
     const ObjectFlavor tuple_flavor(&tupleGCHandler, NULL);
-    const ObjectFlavor file_flavor(&boxGCHandler, NULL);
+    const ObjectFlavor file_flavor(&boxGCHandler, (AllocationKind::FinalizationFunc)file_dtor);
     const ObjectFlavor user_flavor(&hcBoxGCHandler, NULL);
 
     const AllocationKind untracked_kind(NULL, NULL);
     const AllocationKind hc_kind(&hcGCHandler, NULL);
     const AllocationKind conservative_kind(&conservativeGCHandler, NULL);
+    const AllocationKind dict_node_kind(&dictNodeGCHandler, NULL);
 }
 
 void instancemethod_dtor(BoxedInstanceMethod* b) {
@@ -15,8 +15,12 @@
 #ifndef PYSTON_RUNTIME_TYPES_H
 #define PYSTON_RUNTIME_TYPES_H
 
+#include <type_traits>
+
 #include "core/types.h"
 
+#include "gc/collector.h"
+
 namespace pyston {
 
 extern bool IN_SHUTDOWN;
@@ -66,6 +70,10 @@ extern "C" Box* boxBool(bool);
 extern "C" Box* boxInt(i64);
 extern "C" i64 unboxInt(Box*);
 extern "C" Box* boxFloat(double d);
+// The paths of boxInt and boxFloat that allocate a new object.  They're out of line so that the
+// stats they log don't get inlined into jitted code along with the rest of those:
+extern "C" Box* boxUncachedInt(i64 n) NOINLINE;
+extern "C" Box* boxUnrecycledFloat(double d) NOINLINE;
 extern "C" Box* boxInstanceMethod(Box* obj, Box* func);
 extern "C" Box* boxStringPtr(const std::string *s);
 Box* boxString(const std::string &s);
@@ -88,6 +96,14 @@ struct BoxedInt : public Box {
     BoxedInt(int64_t n) __attribute__((visibility("default"))) : Box(&int_flavor, int_cls), n(n) {}
 };
 
+// The value of an int, which might be tagged (see isTaggedInt):
+inline int64_t intValue(const Box* b) {
+    assert(b->cls == int_cls);
+    if (isTaggedInt(b))
+        return untagInt(b);
+    return static_cast<const BoxedInt*>(b)->n;
+}
+
 struct BoxedFloat : public Box {
     double d;
 
@@ -131,16 +147,12 @@ struct BoxedList : public Box {
     void ensure(int space);
 };
 
-struct BoxedTuple : public Box {
-    const std::vector<Box*> elts;
-
-    BoxedTuple(std::vector<Box*> &elts) __attribute__((visibility("default"))) : Box(&tuple_flavor, tuple_cls), elts(elts) {}
-};
-
 struct BoxedFile : public Box {
     FILE *f;
     bool closed;
-    BoxedFile(FILE* f) __attribute__((visibility("default"))) : Box(&file_flavor, file_cls), f(f), closed(false) {}
+    BoxedFile(FILE* f) __attribute__((visibility("default"))) : Box(&file_flavor, file_cls), f(f), closed(false) {
+        gc::registerFinalizable(this);
+    }
 };
 
 struct PyHasher {
@@ -155,12 +167,17 @@ struct PyLt {
     bool operator()(Box*, Box*) const;
 };
 
+// Storage for STL containers.  By default it gets scanned conservatively, in which case
+// kind_data holds the size of the data; see StlStorageKind for the exceptions.
 struct ConservativeWrapper : GCObject {
     void* data[0];
 
-    ConservativeWrapper(size_t data_size) : GCObject(&conservative_kind), data() {
-        assert(data_size % sizeof(void*) == 0);
-        gc_header.kind_data = data_size;
+    ConservativeWrapper(size_t data_size, const AllocationKind* kind = &conservative_kind) : GCObject(kind), data() {
+        if (kind == &conservative_kind) {
+            assert(data_size % sizeof(void*) == 0);
+            assert(data_size < (1<<16));
+            gc_header.kind_data = data_size;
+        }
     }
 
     void *operator new(size_t size, size_t data_size) {
@@ -175,6 +192,59 @@ struct ConservativeWrapper : GCObject {
     }
 };
 
+// The kind that the storage for Ts gets allocated as.  Scanning storage conservatively means
+// an interior-pointer lookup for every word of it, so the containers that the runtime uses a
+// lot get storage that is scanned precisely:
+template <class T>
+struct StlStorageKind {
+    static const AllocationKind* get() {
+        return &conservative_kind;
+    }
+};
+
+extern "C" const AllocationKind dict_node_kind;
+
+// The hash table exceptions depend on libstdc++'s internals, so any other standard library just
+// gets the conservative scanning.
+#ifdef __GLIBCXX__
+// BoxedDict's hash nodes (the map picks whether they cache the hash code the same way):
+typedef std::__detail::_Hash_node<std::pair<Box* const, Box*>, std::__cache_default<Box*, PyHasher>::value> DictNode;
+
+// Whether DictNode is laid out the way that dictNodeGCHandler expects: a _Hash_node_base (the
+// pointer to the next node), the entry, and the cached hash code if there is one.  Anything else
+// could hide pointers that the handler doesn't know about.
+static const bool dict_node_layout_known = std::is_base_of<std::__detail::_Hash_node_base, DictNode>::value
+    && sizeof(std::__detail::_Hash_node_base) == sizeof(void*)
+    && sizeof(DictNode) == sizeof(void*) + sizeof(std::pair<Box* const, Box*>)
+                           + (std::__cache_default<Box*, PyHasher>::value ? sizeof(size_t) : 0);
+
+// These point to the next node, and everything else in them gets visited by dictGCHandler.
+template <>
+struct StlStorageKind<DictNode> {
+    static const AllocationKind* get() {
+        return dict_node_layout_known ? &dict_node_kind : &conservative_kind;
+    }
+};
+
+// Bucket arrays of hash tables: each bucket points into the chain of nodes, all of which are
+// reachable from the table itself, so they don't need to be scanned at all.
+template <>
+struct StlStorageKind<std::__detail::_Hash_node_base*> {
+    static const AllocationKind* get() {
+        return &untracked_kind;
+    }
+};
+#endif
+
+// Arrays of Boxes (eg tuple elements): the owner visits them, since it's the one that knows
+// how many of the slots are in use.
+template <>
+struct StlStorageKind<Box*> {
+    static const AllocationKind* get() {
+        return &untracked_kind;
+    }
+};
+
 template <class T>
 class StlCompatAllocator {
     public:
@@ -197,9 +267,12 @@ class StlCompatAllocator {
 
         pointer allocate(size_t n) {
             size_t to_allocate = n * sizeof(value_type);
-            assert(to_allocate < (1<<16));
 
-            ConservativeWrapper* rtn = new (to_allocate) ConservativeWrapper(to_allocate);
+            ConservativeWrapper* rtn = new (to_allocate) ConservativeWrapper(to_allocate, StlStorageKind<T>::get());
+            // Allocate container storage straight into the old generation: the STL writes into
+            // it without going through the write barrier, so instead the owning object's gc
+            // handler is responsible for visiting any young objects stored in it.
+            gc::setMark(&rtn->gc_header);
             return (pointer)&rtn->data[0];
         }
 
@@ -219,6 +292,22 @@ class StlCompatAllocator {
         void destroy(U* p) {
             p->~U();
         }
+
+        // It's stateless, so any instance can free what another one allocated:
+        bool operator==(const StlCompatAllocator&) const {
+            return true;
+        }
+
+        bool operator!=(const StlCompatAllocator&) const {
+            return false;
+        }
+};
+
+struct BoxedTuple : public Box {
+    typedef std::vector<Box*, StlCompatAllocator<Box*> > GCVector;
+    const GCVector elts;
+
+    BoxedTuple(std::vector<Box*> &elts) __attribute__((visibility("default"))) : Box(&tuple_flavor, tuple_cls), elts(elts.begin(), elts.end()) {}
 };
 
 struct BoxedDict : public Box {
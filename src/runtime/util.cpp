@@ -38,11 +38,11 @@ void parseSlice(BoxedSlice* slice, int size, i64 *out_start, i64 *out_stop, i64
     int64_t istep = 1;
 
     if (step->cls == int_cls) {
-        istep = static_cast<BoxedInt*>(step)->n;
+        istep = intValue(step);
     }
 
     if (start->cls == int_cls) {
-        istart = static_cast<BoxedInt*>(start)->n;
+        istart = intValue(start);
         if (istart < 0)
             istart = size + istart;
     } else {
@@ -52,7 +52,7 @@ void parseSlice(BoxedSlice* slice, int size, i64 *out_start, i64 *out_stop, i64
             istart = size - 1;
     }
     if (stop->cls == int_cls) {
-        istop = static_cast<BoxedInt*>(stop)->n;
+        istop = intValue(stop);
         if (istop < 0)
             istop = size + istop;
     } else {
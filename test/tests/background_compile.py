@@ -0,0 +1,31 @@
+# run_args: -B
+# statcheck: stats['background_compiles_queued'] >= 1
+# statcheck: stats.get('stats_overflow', 0) == 0
+# Reopts happen on the compile thread with -B, which registers and logs stats concurrently with
+# the main thread; the functions have to keep giving the right answers while their new versions
+# get compiled and installed.
+
+class C(object):
+    pass
+
+def f1(c, i):
+    c.a = i
+    return c.a + 1
+
+def f2(c, i):
+    c.b = i * 2
+    return c.b - i
+
+def f3(c, i):
+    c.a = c.b = i
+    return c.a * c.b
+
+def f4(x):
+    return x % 7 + x // 3
+
+c = C()
+t = 0
+for i in xrange(20000):
+    t = t + f1(c, i) + f2(c, i) + f3(c, i) % 1000 + f4(i)
+print t
+print c.a, c.b
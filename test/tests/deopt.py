@@ -0,0 +1,37 @@
+# statcheck: stats['speculation_failures'] >= 100
+# statcheck: stats['deopts'] >= 1
+# statcheck: stats['deopts_recompiled'] >= 1
+# statcheck: stats.get('deopts_f', 0) >= 1
+# statcheck: any(k.startswith('deopts_f_line') for k in stats)
+# Warm up a function so that it gets recompiled speculating on the type of an attribute, then
+# change that type: the guards fail, the function falls back to its unspeculated code, and after
+# enough failures it gets recompiled without the speculation.  The results have to stay right
+# the whole way through.
+
+class C(object):
+    pass
+
+def f(c, n):
+    x = c.a
+    return x + x * n
+
+c = C()
+t = 0
+for i in xrange(1000):
+    c.a = i
+    t = t + f(c, 2)
+print t
+
+c.a = 1.5
+t = 0.0
+for i in xrange(500):
+    t = t + f(c, i)
+print t
+
+c.a = "ab"
+for i in xrange(300):
+    s = f(c, 2)
+print s
+
+c.a = 7
+print f(c, 3)
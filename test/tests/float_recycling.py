@@ -0,0 +1,13 @@
+# run_args: -A {tmpdir}/profile.heap -a 4096
+# statcheck: stats.get('gc_objects_recycled', 0) > 0
+# statcheck: stats.get('heap_profile_samples', 0) > 0
+# Almost everything this allocates is a float, so most of them end up being recycled ones; those
+# still have to get sampled by the heap profiler and count towards triggering collections.
+
+def f(n):
+    t = 0.0
+    for i in xrange(n):
+        t = t + i * 0.5
+    return t
+
+print f(2000000) == 999999500000.0
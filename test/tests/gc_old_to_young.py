@@ -0,0 +1,35 @@
+# Store newly-allocated objects into objects that have already survived some collections,
+# and make sure that the following collections don't free them.
+
+class C(object):
+    pass
+
+def churn(n):
+    # Allocate enough garbage to trigger a few collections
+    t = 0
+    for i in xrange(n):
+        l = [i, i * 1.0]
+        t = t + len(l)
+    return t
+
+l = []
+d = {}
+c = C()
+c.a = None
+for i in xrange(20):
+    l.append(None)
+churn(100000)
+
+for i in xrange(20):
+    l[i] = str(i)
+    d[i] = str(i * 2)
+    c.a = str(i * 3)
+    churn(2000)
+
+c.b = str(100)
+l.append(str(200))
+churn(20000)
+
+print l
+print sorted(d.items())
+print c.a, c.b
@@ -0,0 +1,24 @@
+# run_args: -C {tmpdir}
+# run_twice
+# statcheck: stats['object_cache_hits'] >= 1
+# The first run fills the object cache and the second one should load its code from it.  The
+# runs allocate different amounts before f gets compiled, so the runtime objects whose addresses
+# its code embeds (like its string constants) are at different addresses in each run.
+import time
+
+junk = []
+for i in xrange(int(time.time() * 1000) % 1000):
+    junk.append([i])
+
+class C(object):
+    pass
+
+def f(c, i):
+    c.x = "abc"
+    return len(c.x) + i * 3 + len("hello world")
+
+c = C()
+t = 0
+for i in xrange(2000):
+    t = t + f(c, i)
+print t, c.x
@@ -0,0 +1,21 @@
+# Reoptimize a function while frames of its older versions are still on the stack, and make
+# sure that those frames keep working afterwards, including OSR'ing out of their loops.
+
+def f(n, depth):
+    t = 0
+    for i in xrange(n):
+        if depth:
+            t = t + f(5, depth - 1)
+        else:
+            t = t + i
+    return t
+
+# The outermost frame is in the first version of f, and the calls it makes get f reoptimized
+# (and the old versions retired) long before its loop is done:
+print f(20000, 1)
+print f(2000, 2)
+
+# By now the versions that were running above can be freed; this runs whatever f is now:
+for i in xrange(1000):
+    f(10, 0)
+print f(20000, 1)
@@ -0,0 +1,86 @@
+# run_args: -I
+# Ints with -I, where small ints are tagged instead of boxed: arithmetic that crosses the edges of
+# the tagged range (into ints that have to be boxed again), tagged and boxed ints as dict keys,
+# identity of small ints, ints that have to survive collections, and len() and truth tests.
+
+LIMIT = 1 << 24
+
+def edges():
+    l = []
+    for base in [LIMIT, -LIMIT]:
+        for d in xrange(-3, 4):
+            l.append(base + d)
+    return l
+
+# Arithmetic going in and out of the tagged range:
+for x in edges():
+    print x, x + 1, x - 1, x * 2, x // 2, x % 7, -x, ~x, x << 3, x >> 1, x * x
+t = 0
+for i in xrange(100):
+    t = t + (LIMIT - 50)
+print t, t - t, t // 100 == LIMIT - 50
+big = 1
+for i in xrange(60):
+    big = big * 2
+print big, big // (LIMIT * 4), big - big + 1
+
+# Tagged and boxed ints as dict keys; the lookups use ints that got computed differently:
+d = {}
+for x in edges():
+    d[x] = x * 10
+d[0] = "zero"
+d[5] = "five"
+d[big] = "big"
+for x in edges():
+    y = (x * 3 - x) // 2
+    print y, d[y]
+print d[2 + 3], d[10 - 10], d[big // 2 * 2], len(d)
+print sorted(d.keys())
+
+# Small ints:
+a = 5
+b = 2 + 3
+c = 10 // 2
+print a is b, b is c, a == c, 0 is (a - b), -1 is (b - a - 1), 256 is (255 + 1)
+
+# Ints kept only by other objects, across enough allocation to cause some collections:
+class C(object):
+    pass
+
+kept = []
+for i in xrange(1000):
+    o = C()
+    o.n = i * 37 - 5000
+    o.m = LIMIT + i
+    kept.append(o)
+    kept.append(i * 11)
+    kept.append([i, LIMIT - i])
+for i in xrange(200000):
+    garbage = [i, i + 1, str(i)]
+t = 0
+for x in kept:
+    if isinstance(x, C):
+        t = t + x.n + x.m
+    elif isinstance(x, list):
+        t = t + x[0] - x[1]
+    else:
+        t = t + x
+print t
+
+# len() and truth tests:
+lists = [[], [1], range(10), range(LIMIT % 1000)]
+for l in lists:
+    n = len(l)
+    if n:
+        print n, "nonempty", not n, n * n
+    else:
+        print n, "empty", not n
+    if l:
+        print "true"
+    else:
+        print "false"
+for x in [0, 1, -1, LIMIT, -LIMIT, LIMIT - LIMIT, big, big - big]:
+    if x:
+        print x, "is true"
+    else:
+        print x, "is false"
@@ -0,0 +1,23 @@
+# run_args: -L /dev/null
+# statcheck: stats['tiering_reopt_next'] >= 2
+# statcheck: stats['tiering_osr_hot_loop'] >= 1
+# statcheck: stats.get('tiering_reopt_decayed', 0) == 0
+# statcheck: stats.get('tiering_reopt_small', 0) == 0
+# The default tiering policy, with its decisions getting logged: functions should get reopted one
+# effort level at a time, and loops should OSR straight to MAXIMAL once they're out of the
+# interpreter, regardless of timing.
+
+def f(x):
+    return x * 3 + 1
+
+def loop(n):
+    t = 0
+    for i in xrange(n):
+        t = t + f(i) % 7
+    return t
+
+print loop(30000)
+t = 0
+for i in xrange(12000):
+    t = t + f(i)
+print t
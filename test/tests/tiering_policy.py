@@ -0,0 +1,16 @@
+# run_args: -P reopt_interpreted=2,reopt_minimal=20,reopt_moderate=100,small_function_blocks=1000
+# statcheck: stats['tiering_reopt_interpreted'] >= 1
+# statcheck: stats['tiering_reopt_small'] >= 1
+# statcheck: stats.get('tiering_reopt_decayed', 0) == 0
+# Non-default tiering settings: with low reopt thresholds and every function counting as small,
+# functions should go from MINIMAL straight to MAXIMAL.
+
+def f(x):
+    if x % 3:
+        return x * 2
+    return x + 1
+
+t = 0
+for i in xrange(1000):
+    t = t + f(i)
+print t
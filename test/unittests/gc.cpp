@@ -1,10 +1,14 @@
+#include <chrono>
+#include <cstdio>
 #include <memory>
 #include <vector>
 #include <unordered_set>
 
 #include "gtest/gtest.h"
 
+#include "gc/collector.h"
 #include "gc/gc_alloc.h"
+#include "gc/root_finder.h"
 
 using namespace pyston;
 using namespace pyston::gc;
@@ -57,6 +61,16 @@ TEST(gc, alloc128) { testAlloc(128); }
 TEST(gc, alloc258) { testAlloc(258); }
 TEST(gc, alloc3584) { testAlloc(3584); }
 
+TEST(gc, sizeclasses) {
+    for (int bytes = 1; bytes <= sizes[NUM_BUCKETS - 1]; bytes++) {
+        int sc = sizeClassFor(bytes);
+        ASSERT_GE(sizes[sc], bytes);
+        if (sc > 0) {
+            ASSERT_LT(sizes[sc - 1], bytes);
+        }
+    }
+}
+
 TEST(gc, largeallocs) {
     int s1 = 1 << 20;
     char* d1 = (char*)gc_alloc(s1);
@@ -98,3 +112,233 @@ TEST(gc, freeingLarge) {
     }
 }
 
+
+TEST(gc, interiorPointers) {
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        int size = sizes[i];
+        std::vector<char*> allocd;
+        for (int j = 0; j < 1000; j++) {
+            allocd.push_back((char*)gc_alloc(size));
+        }
+
+        for (char* p : allocd) {
+            for (int offset = 0; offset < size; offset++) {
+                ASSERT_EQ(p, global_heap.getAllocationFromInteriorPointer(p + offset));
+            }
+        }
+
+        for (char* p : allocd) {
+            gc_free(p);
+            ASSERT_EQ(NULL, global_heap.getAllocationFromInteriorPointer(p));
+        }
+    }
+
+    int size = 1 << 20;
+    char* large = (char*)gc_alloc(size);
+    ASSERT_EQ(large, global_heap.getAllocationFromInteriorPointer(large));
+    ASSERT_EQ(large, global_heap.getAllocationFromInteriorPointer(large + size / 2));
+    ASSERT_EQ(large, global_heap.getAllocationFromInteriorPointer(large + size - 1));
+    ASSERT_EQ(NULL, global_heap.getAllocationFromInteriorPointer(large + size));
+    gc_free(large);
+    ASSERT_EQ(NULL, global_heap.getAllocationFromInteriorPointer(large));
+
+    int on_stack;
+    ASSERT_EQ(NULL, global_heap.getAllocationFromInteriorPointer(&on_stack));
+    ASSERT_EQ(NULL, global_heap.getAllocationFromInteriorPointer(NULL));
+    ASSERT_EQ(NULL, global_heap.getAllocationFromInteriorPointer((void*)SMALL_ARENA_START));
+}
+
+// Not really a test: this measures how fast conservative scanning can resolve pointers.
+TEST(gc, interiorPointerSpeed) {
+    const int N = 10000;
+    std::vector<void*> heap_ptrs, other_ptrs;
+    for (int i = 0; i < N; i++) {
+        int size = 16 << (i % 8);
+        char* p = (char*)gc_alloc(size);
+        heap_ptrs.push_back(p + (i * 7) % size);
+        // A mix of the kinds of non-heap words that show up on the stack:
+        other_ptrs.push_back((void*)(uintptr_t)i);
+        other_ptrs.push_back(&heap_ptrs);
+    }
+
+    const int REPEATS = 200;
+    for (int heap = 1; heap >= 0; heap--) {
+        std::vector<void*> &ptrs = heap ? heap_ptrs : other_ptrs;
+
+        long found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < REPEATS; r++) {
+            for (void* p : ptrs) {
+                found += global_heap.getAllocationFromInteriorPointer(p) != NULL;
+            }
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        ASSERT_EQ(heap ? (long)ptrs.size() * REPEATS : 0, found);
+        printf("%s pointers: %.1fM lookups/sec\n", heap ? "heap" : "non-heap", ptrs.size() * REPEATS / secs / 1e6);
+    }
+
+    for (void* p : heap_ptrs) {
+        gc_free(global_heap.getAllocationFromInteriorPointer(p));
+    }
+}
+
+static void noopGCHandler(GCVisitor* v, void* p) {
+}
+static const AllocationKind recycled_test_kind(&noopGCHandler, NULL);
+
+TEST(gc, recycling) {
+    global_heap.setRecycledKind(&recycled_test_kind);
+
+    const int N = 2000;
+    std::unordered_set<void*> dead;
+    for (int i = 0; i < N; i++) {
+        void* p = gc_alloc(32);
+        new (p) GCObjectHeader(&recycled_test_kind);
+        dead.insert(p);
+    }
+
+    // Nothing got marked, so this is a collection that found all of them dead:
+    global_heap.flushThreadCaches();
+    global_heap.finishSweep();
+    global_heap.startSweep(false);
+
+    // Allocating more objects of the same size sweeps their blocks, which should set some of them
+    // aside (and free the rest).  There might be other blocks to allocate out of first, though.
+    std::unordered_set<void*> others;
+    std::vector<void*> recycled;
+    while (recycled.empty()) {
+        ASSERT_LT(others.size(), 100 * N);
+        others.insert(gc_alloc(32));
+        if (void* p = global_heap.allocRecycled())
+            recycled.push_back(p);
+    }
+    while (void* p = global_heap.allocRecycled()) {
+        recycled.push_back(p);
+    }
+
+    ASSERT_LE(recycled.size(), RECYCLE_LIST_SIZE);
+    for (void* p : recycled) {
+        ASSERT_EQ(1, dead.count(p));
+        ASSERT_EQ(0, others.count(p));
+    }
+
+    for (void* p : others) {
+        gc_free(p);
+    }
+    for (void* p : recycled) {
+        gc_free(p);
+    }
+    global_heap.finishSweep();
+}
+
+// A caller's pointer that only lives in a callee-save register has to survive a collection that
+// happens while a precise frame has that register spilled.  The two functions below set that up:
+// holdInCalleeSaveRegister keeps a new object only in r12, and clobberCalleeSaveRegister (which
+// the test registers as a precise frame with no roots) spills r12, zeroes it and collects.
+extern "C" void* allocCSRTestObject();
+extern "C" void collectForCSRTest();
+extern "C" void* holdInCalleeSaveRegister();
+extern "C" char csrTestCallStart[], csrTestCallEnd[];
+
+asm(R"(
+    .text
+    .globl holdInCalleeSaveRegister
+    .type holdInCalleeSaveRegister, @function
+holdInCalleeSaveRegister:
+    .cfi_startproc
+    pushq %r12
+    .cfi_def_cfa_offset 16
+    .cfi_offset %r12, -16
+    call allocCSRTestObject
+    movq %rax, %r12
+    xorl %eax, %eax
+    call clobberCalleeSaveRegister
+    movq %r12, %rax
+    popq %r12
+    .cfi_def_cfa_offset 8
+    ret
+    .cfi_endproc
+
+    .type clobberCalleeSaveRegister, @function
+clobberCalleeSaveRegister:
+    .cfi_startproc
+    pushq %r12
+    .cfi_def_cfa_offset 16
+    .cfi_offset %r12, -16
+    xorl %r12d, %r12d
+    .globl csrTestCallStart
+csrTestCallStart:
+    call collectForCSRTest
+    .globl csrTestCallEnd
+csrTestCallEnd:
+    popq %r12
+    .cfi_def_cfa_offset 8
+    ret
+    .cfi_endproc
+)");
+
+#define CSR_TEST_PAYLOAD 0x5eed5eed5eed5eedL
+// Kept xor'ed with this, so that the conservative scanner doesn't see them:
+#define CSR_TEST_HIDE 0xa5a5a5a5a5a5a5a5L
+static uintptr_t csr_test_obj_hidden = 0;
+static bool csr_test_obj_marked = false;
+
+struct CSRTestObject : public GCObjectHeader {
+    int64_t payload;
+};
+
+static const AllocationKind csr_test_kind(&noopGCHandler, NULL);
+
+extern "C" void* __attribute__((noinline)) allocCSRTestObject() {
+    CSRTestObject* obj = (CSRTestObject*)gc_alloc(sizeof(CSRTestObject));
+    new (obj) GCObjectHeader(&csr_test_kind);
+    obj->payload = CSR_TEST_PAYLOAD;
+    csr_test_obj_hidden = (uintptr_t)obj ^ CSR_TEST_HIDE;
+    return obj;
+}
+
+extern "C" void __attribute__((noinline)) collectForCSRTest() {
+    runCollection();
+}
+
+static void checkCSRTestObjMarked() {
+    if (csr_test_obj_hidden)
+        csr_test_obj_marked = isMarked(headerFromObject((void*)(csr_test_obj_hidden ^ CSR_TEST_HIDE)));
+}
+
+TEST(gc, calleeSaveRegisterRoots) {
+    PreciseFrameRoots* roots = new PreciseFrameRoots();
+    roots->num_stack_args = 0;
+    registerPreciseFrameRoots(csrTestCallStart, csrTestCallEnd, roots);
+    registerPostMarkHook(&checkCSRTestObjMarked);
+
+    CSRTestObject* obj = (CSRTestObject*)holdInCalleeSaveRegister();
+    ASSERT_TRUE(csr_test_obj_marked);
+    ASSERT_EQ(CSR_TEST_PAYLOAD, obj->payload);
+    ASSERT_EQ(obj, global_heap.getAllocationFromInteriorPointer(obj));
+
+    csr_test_obj_hidden = 0;
+    unregisterPreciseFrameRoots(csrTestCallStart, csrTestCallEnd);
+}
+
+static int finalized_count = 0;
+static void countingFinalizer(void* p) {
+    finalized_count++;
+}
+static const AllocationKind finalizable_test_kind(&noopGCHandler, &countingFinalizer);
+
+// Objects that get freed explicitly shouldn't get finalized by a later collection.
+TEST(gc, freeingFinalizable) {
+    const int N = 100;
+    for (int i = 0; i < N; i++) {
+        void* p = gc_alloc(32);
+        new (p) GCObjectHeader(&finalizable_test_kind);
+        registerFinalizable(p);
+        gc_free(p);
+    }
+
+    runCollection();
+    runPendingFinalizers();
+    ASSERT_EQ(0, finalized_count);
+}
@@ -13,6 +13,7 @@ import os
 import Queue
 import re
 import resource
+import shutil
 import signal
 import subprocess
 import sys
@@ -66,6 +67,7 @@ def run_test(fn, check_stats, run_memcheck):
 
     statchecks = []
     jit_args = ["-csr"] + EXTRA_JIT_ARGS
+    run_twice = False
     for l in open(fn):
         if not l.startswith("#"):
             break;
@@ -75,8 +77,35 @@ def run_test(fn, check_stats, run_memcheck):
         if l.startswith("# run_args:"):
             l = l[len("# run_args:"):].split()
             jit_args += l
-
+        if l.startswith("# run_twice"):
+            # For testing state that persists between runs: the test gets run once first, which
+            # has to succeed with the same output, and the statchecks apply to the second run.
+            run_twice = True
+
+    # "{tmpdir}" in the run_args gets replaced by a new empty directory:
+    tmpdir = None
+    if any("{tmpdir}" in a for a in jit_args):
+        tmpdir = tempfile.mkdtemp()
+        jit_args = [a.replace("{tmpdir}", tmpdir) for a in jit_args]
+
+    try:
+        return _run_test(fn, r, jit_args, statchecks, run_twice, check_stats, run_memcheck)
+    finally:
+        if tmpdir:
+            shutil.rmtree(tmpdir)
+
+def _run_test(fn, r, jit_args, statchecks, run_twice, check_stats, run_memcheck):
     run_args = ["./%s" % IMAGE] + jit_args + ["-q", fn]
+
+    first_out = None
+    if run_twice:
+        p = subprocess.Popen(run_args, stdout=subprocess.PIPE, stderr=subprocess.PIPE, stdin=open("/dev/null"), preexec_fn=set_ulimits)
+        first_out, first_err = p.communicate()
+        code = p.wait()
+        if code != 0:
+            raise Exception("First run exited with code %d\n%s" % (code, first_err))
+        first_out = first_out.split("Stats:")[0]
+
     start = time.time()
     p = subprocess.Popen(run_args, stdout=subprocess.PIPE, stderr=subprocess.PIPE, stdin=open("/dev/null"), preexec_fn=set_ulimits)
     out, err = p.communicate()
@@ -95,6 +124,8 @@ def run_test(fn, check_stats, run_memcheck):
             stats[k.strip()] = int(v)
 
     expected_code, expected_out, expected_err = get_expected_output(fn)
+    if first_out is not None and first_out != out:
+        raise Exception("Failed on %s: the two runs gave different output" % fn)
     if code != expected_code:
         color = 31 # red
 